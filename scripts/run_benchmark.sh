@@ -7,5 +7,15 @@ set -x
 ./scripts/check_build.sh
 
 ./temp/build-release/demo_coarse_grained 8 4 100000
+./temp/build-release/demo_coarse_grained_open_addressing 8 4 100000
+./temp/build-release/demo_coarse_grained_swiss 8 4 100000
 ./temp/build-release/demo_striped 8 4 100000
+./temp/build-release/demo_striped_open_addressing 8 4 100000
+./temp/build-release/demo_striped_swiss 8 4 100000
+./temp/build-release/demo_striped_incremental 8 4 100000
 ./temp/build-release/demo_refinable 8 4 100000
+./temp/build-release/demo_lock_free 8 4 100000
+
+# Thread-scaling record of every set, written for each build
+./temp/build-release/demo_workload --threads=sweep --repetitions=3 \
+    --pin=compact --format=csv > temp/scaling.csv
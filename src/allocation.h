@@ -0,0 +1,56 @@
+#ifndef ALLOCATION_H
+#define ALLOCATION_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+// Allocators of the storage engines. Engines take any standard allocator, and
+// draw from per-region memory pools when given a PoolAllocator
+namespace allocation {
+
+// Allocator drawing from the pool of the region it was made for, see
+// RegionPools
+template <typename T> using PoolAllocator = std::pmr::polymorphic_allocator<T>;
+
+// True if |Allocator| is a PoolAllocator
+template <typename Allocator>
+constexpr bool kPooled = std::is_same<
+    Allocator, PoolAllocator<typename Allocator::value_type>>::value;
+
+// One size-class pool per region of a table, shared by the tables grown from
+// it so that the memory of drained buckets is reused rather than returned to
+// the global allocator. The pools are not synchronized: as only the lock of a
+// region ever allocates from its pool, threads working on different regions
+// never contend inside the allocator, and never on a lock of their own
+class RegionPools {
+public:
+  // Adds pools up to one per region of |num_regions|. Must not run while any
+  // pool is in use
+  void Reserve(size_t num_regions) {
+    while (pools_.size() < num_regions) {
+      pools_.push_back(
+          std::make_unique<std::pmr::unsynchronized_pool_resource>());
+    }
+  }
+
+  // Returns the allocator for storage of |region|, which draws from the pool
+  // of that region if |Allocator| is a PoolAllocator, and is default
+  // constructed otherwise
+  template <typename Allocator> Allocator Get(size_t region) const {
+    if constexpr (kPooled<Allocator>) {
+      return Allocator(pools_[region].get());
+    } else {
+      return Allocator();
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<std::pmr::unsynchronized_pool_resource>> pools_;
+};
+
+} // namespace allocation
+
+#endif // ALLOCATION_H
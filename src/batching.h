@@ -0,0 +1,58 @@
+#ifndef BATCHING_H
+#define BATCHING_H
+
+#include <cstddef>
+#include <vector>
+
+// Helpers shared by the batched AddAll, RemoveAll and ContainsMany overrides
+namespace batching {
+
+// How many elements ahead batch operations prefetch buckets
+constexpr size_t kPrefetchDistance = 8;
+
+// Returns the |Hash| of every element of |elems|
+template <typename Hash, typename T>
+std::vector<size_t> HashAll(const std::vector<T> &elems) {
+  std::vector<size_t> hashes(elems.size());
+  for (size_t i = 0; i < elems.size(); i++) {
+    hashes[i] = Hash()(elems[i]);
+  }
+  return hashes;
+}
+
+// Returns the indices of |hashes| ordered so that the elements of each stripe
+// are adjacent, using a counting sort on hash % num_stripes. |num_stripes| must
+// be a power of two
+inline std::vector<size_t> GroupByStripe(const std::vector<size_t> &hashes,
+                                         size_t num_stripes) {
+  std::vector<size_t> starts(num_stripes + 1, 0);
+  for (size_t hash : hashes) {
+    starts[(hash & (num_stripes - 1)) + 1]++;
+  }
+  for (size_t stripe = 0; stripe < num_stripes; stripe++) {
+    starts[stripe + 1] += starts[stripe];
+  }
+  std::vector<size_t> order(hashes.size());
+  for (size_t i = 0; i < hashes.size(); i++) {
+    order[starts[hashes[i] & (num_stripes - 1)]++] = i;
+  }
+  return order;
+}
+
+// Returns the end of the run of |order| starting at |begin| whose elements all
+// belong to the same stripe
+inline size_t GroupEnd(const std::vector<size_t> &hashes,
+                       const std::vector<size_t> &order, size_t begin,
+                       size_t num_stripes) {
+  size_t mask = num_stripes - 1;
+  size_t stripe = hashes[order[begin]] & mask;
+  size_t end = begin + 1;
+  while (end < order.size() && (hashes[order[end]] & mask) == stripe) {
+    end++;
+  }
+  return end;
+}
+
+} // namespace batching
+
+#endif // BATCHING_H
@@ -5,16 +5,47 @@
 #include <chrono>
 #include <cstddef>
 #include <iostream>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "src/hash_set_base.h"
+#include "src/stats.h"
 
 namespace benchmark {
 
-void ThreadBody(HashSetBase<int> &hash_set, size_t chunk_size, size_t id,
-                size_t &max_observed_size);
+// Adds, looks up and removes the elements of chunk |id| of the benchmark. Takes
+// the concrete set type so that the calls need no virtual dispatch
+template <typename HashSetType>
+void ThreadBody(HashSetType &hash_set, size_t chunk_size, size_t id,
+                size_t &max_observed_size) {
+  max_observed_size = 0;
+  for (size_t k = 0; k < chunk_size * 2; k++) {
+    int elem = static_cast<int>(id * chunk_size + k);
+    hash_set.Add(elem);
+    max_observed_size = std::max(max_observed_size, hash_set.Size());
+  }
+  for (size_t j = 0; j < 20; j++) {
+    for (size_t k = 0; k < chunk_size * 2; k++) {
+      int elem = static_cast<int>(id * chunk_size + k);
+      if (hash_set.Contains(elem)) {
+        if ((elem % 20) == 0) {
+          hash_set.Remove(elem);
+          max_observed_size = std::max(max_observed_size, hash_set.Size());
+        }
+      }
+    }
+  }
+  for (size_t k = 0; k < chunk_size * 2; k++) {
+    int elem = static_cast<int>(id * chunk_size + k);
+    hash_set.Add(elem);
+    max_observed_size = std::max(max_observed_size, hash_set.Size());
+  }
+}
 
 template <typename HashSetType> int RunBenchmark(int argc, char **argv) {
+  static_assert(IsHashSet<HashSetType, int>::value,
+                "RunBenchmark needs a hash set of ints");
   if (argc != 4) {
     std::cerr << "Usage: " << argv[0]
               << " num_threads initial_capacity chunk_size" << std::endl;
@@ -37,8 +68,9 @@ template <typename HashSetType> int RunBenchmark(int argc, char **argv) {
 
   auto begin_time = std::chrono::high_resolution_clock::now();
   for (size_t i = 0; i < num_threads; i++) {
-    threads.emplace_back(std::thread(ThreadBody, std::ref(hash_set), chunk_size,
-                                     i, std::ref(max_observed_sizes.at(i))));
+    threads.emplace_back(std::thread(ThreadBody<HashSetType>,
+                                     std::ref(hash_set), chunk_size, i,
+                                     std::ref(max_observed_sizes.at(i))));
   }
   for (auto &thread : threads) {
     thread.join();
@@ -50,15 +82,27 @@ template <typename HashSetType> int RunBenchmark(int argc, char **argv) {
       std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
 
   size_t expected_size = chunk_size * (num_threads + 1);
-  if (hash_set.Size() != expected_size) {
-    std::cerr << argv[0] << " failed: size " << hash_set.Size()
+  size_t size = hash_set.SizeExact();
+  if (size != expected_size) {
+    std::cerr << argv[0] << " failed: size " << size
               << " does not match expected size " << expected_size << std::endl;
     return 1;
   }
-  for (size_t i = 0; i < chunk_size * (num_threads + 1); i++) {
-    int expected_value = static_cast<int>(i);
-    if (!hash_set.Contains(expected_value)) {
-      std::cerr << argv[0] << " failed: expected value " << expected_value
+  size_t visited = 0;
+  hash_set.ForEach([&](int /*elem*/) { visited++; });
+  if (visited != expected_size) {
+    std::cerr << argv[0] << " failed: visited " << visited
+              << " elements instead of " << expected_size << std::endl;
+    return 1;
+  }
+  std::vector<int> expected_values(expected_size);
+  for (size_t i = 0; i < expected_size; i++) {
+    expected_values[i] = static_cast<int>(i);
+  }
+  std::vector<bool> found = hash_set.ContainsMany(expected_values);
+  for (size_t i = 0; i < expected_size; i++) {
+    if (!found[i]) {
+      std::cerr << argv[0] << " failed: expected value " << expected_values[i]
                 << " not found" << std::endl;
       return 1;
     }
@@ -67,6 +111,9 @@ template <typename HashSetType> int RunBenchmark(int argc, char **argv) {
   std::cout << argv[0] << " succeeded" << std::endl;
   std::cout << "Concurrent computation took:" << std::endl;
   std::cout << "  " << millis << " ms" << std::endl;
+  if constexpr (stats::kEnabled) {
+    stats::Print(std::cout, hash_set.Stats());
+  }
   return 0;
 }
 
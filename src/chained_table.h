@@ -0,0 +1,252 @@
+#ifndef CHAINED_TABLE_H
+#define CHAINED_TABLE_H
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/allocation.h"
+#include "src/hashing.h"
+#include "src/resizing.h"
+#include "src/stats.h"
+
+// Bucket storage where every bucket is its own vector of elements. This is the
+// default storage engine of the hash sets.
+//
+// A storage engine is addressed by the full hash of an element and provides
+// Contains, Insert, Erase, Full, Rehash, Rehashed, Grow, Grown, Prefetch,
+// Capacity, ForEach, ForEachInRegion and AttachProbes. Rehash and Rehashed
+// rebuild the table with a new capacity, larger or smaller, and number of
+// regions, for sets whose locks multiply as the table grows; Rehash moves the
+// elements into the new storage, while Rehashed copies them and leaves the
+// table untouched. Both take an optional resizing::SerialFor or ParallelFor
+// that runs the rebuild of every old region: an element stays in its region,
+// or in one congruent to it when the regions multiply, so the old regions can
+// be rebuilt in parallel. Grow and Grown double the capacity. kMaxLoad is the
+// load, in elements per unit of capacity, at which the engine reports itself
+// Full. kStableStorage tells whether memory is only ever released by Rehash,
+// in which case Contains may safely race with writers as long as the caller
+// discards its result when a writer got in the way (see HashSetStriped). Sets
+// that guard the table with several locks pass the number of locks, a power
+// of two, as |num_regions|; the engine must then only ever touch storage
+// owned by lock hash % num_regions when handling an element with that hash.
+// Here bucket i is always guarded by lock i % num_regions, as the capacity
+// stays a multiple of the number of locks.
+//
+// Engines hash elements with |Hash| when they grow and compare them with
+// |KeyEqual|; both must be default constructible. Contains accepts any key
+// that |KeyEqual| compares with the elements, hashed by the caller, and Insert
+// moves rvalue elements into the table. Bucket counts are powers of
+// two, so the bucket of a hash is found by masking rather than by a division.
+// Engines store elements with |Allocator|. With an allocation::PoolAllocator,
+// ChainedTable gives every region its own pool, which is only used under the
+// lock of that region.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Allocator = std::allocator<T>>
+class ChainedTable {
+public:
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+
+  explicit ChainedTable(size_t capacity, size_t num_regions = 1)
+      : ChainedTable(capacity, num_regions,
+                     std::make_shared<allocation::RegionPools>()) {}
+
+  // Returns the number of buckets
+  [[nodiscard]] size_t Capacity() const { return buckets_.size(); }
+
+  // Returns true iff an element equal to |key|, whose hash is |hash|, is in
+  // the table
+  template <typename K>
+  [[nodiscard]] bool Contains(size_t hash, const K &key) const {
+    return VectorContains(buckets_[hash & mask_], key);
+  }
+
+  // Inserts |elem| into its bucket. Returns false if it was already present
+  bool Insert(size_t hash, const T &elem) { return InsertImpl(hash, elem); }
+
+  // Moves |elem| into its bucket, unless it was already present
+  bool Insert(size_t hash, T &&elem) {
+    return InsertImpl(hash, std::move(elem));
+  }
+
+  // Removes |elem| from its bucket. Returns false if it was absent
+  bool Erase(size_t hash, const T &elem) {
+    Bucket &bucket = GetBucket(hash);
+    for (auto it = bucket.begin(); it != bucket.end(); it++) {
+      if (KeyEqual()(*it, elem)) {
+        bucket.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Hints the processor to start loading the bucket of |hash|
+  void Prefetch(size_t hash) const {
+    __builtin_prefetch(&buckets_[hash & mask_]);
+  }
+
+  // Buckets can always take another element
+  [[nodiscard]] bool Full(size_t /*hash*/) const { return false; }
+
+  // Calls |visit| on every element
+  template <typename Visit> void ForEach(Visit visit) const {
+    for (const auto &bucket : buckets_) {
+      for (const auto &elem : bucket) {
+        visit(elem);
+      }
+    }
+  }
+
+  // Calls |visit| on every element of |region|, that is on the buckets i with
+  // i % num_regions == region
+  template <typename Visit>
+  void ForEachInRegion(size_t region, Visit visit) const {
+    for (size_t i = region; i < buckets_.size(); i += num_regions_) {
+      for (const auto &elem : buckets_[i]) {
+        visit(elem);
+      }
+    }
+  }
+
+  // Records the probe length of every lookup in |histogram|, as will the
+  // tables grown from this one
+  void AttachProbes(stats::ProbeHistogram *histogram) {
+    probes_.Attach(histogram);
+  }
+
+  // Pushing into a bucket may reallocate it
+  static constexpr bool kStableStorage = false;
+
+  // Buckets never fill up
+  static constexpr double kMaxLoad = std::numeric_limits<double>::infinity();
+
+  // Doubles the number of buckets, moving the elements over
+  void Grow() { Grow(num_regions_); }
+
+  // Doubles the number of buckets, at least one per region of |num_regions|
+  void Grow(size_t num_regions) { Rehash(buckets_.size() * 2, num_regions); }
+
+  // Returns a copy of the table with twice as many buckets, leaving this one
+  // untouched
+  [[nodiscard]] ChainedTable Grown() const { return Grown(num_regions_); }
+
+  // Returns a copy of the table with twice as many buckets, at least one per
+  // region of |num_regions|
+  [[nodiscard]] ChainedTable Grown(size_t num_regions) const {
+    return Rehashed(buckets_.size() * 2, num_regions);
+  }
+
+  // Rebuilds the table with |capacity| buckets rounded up to a power of two,
+  // at least one per region of |num_regions|. Elements are moved rather than
+  // copied, and every old bucket is released as soon as it is drained, so
+  // that pooled memory is reused by the new buckets of the same region
+  template <typename ForEachIndex = resizing::SerialFor>
+  void Rehash(size_t capacity, size_t num_regions,
+              ForEachIndex for_each_index = {}) {
+    ChainedTable rehashed(capacity, num_regions, pools_);
+    rehashed.probes_ = probes_;
+    ForEachOldRegion(rehashed, for_each_index, [&](size_t region) {
+      for (size_t i = region; i < buckets_.size(); i += num_regions_) {
+        for (auto &elem : buckets_[i]) {
+          rehashed.GetBucket(Hash()(elem)).push_back(std::move(elem));
+        }
+        Bucket(buckets_[i].get_allocator()).swap(buckets_[i]);
+      }
+    });
+    *this = std::move(rehashed);
+  }
+
+  // Returns a copy of the table rebuilt as Rehash does
+  template <typename ForEachIndex = resizing::SerialFor>
+  [[nodiscard]] ChainedTable Rehashed(size_t capacity, size_t num_regions,
+                                      ForEachIndex for_each_index = {}) const {
+    ChainedTable rehashed(capacity, num_regions, pools_);
+    rehashed.probes_ = probes_;
+    ForEachOldRegion(rehashed, for_each_index, [&](size_t region) {
+      for (size_t i = region; i < buckets_.size(); i += num_regions_) {
+        for (auto &elem : buckets_[i]) {
+          rehashed.GetBucket(Hash()(elem)).push_back(elem);
+        }
+      }
+    });
+    return rehashed;
+  }
+
+private:
+  using Bucket = std::vector<T, Allocator>;
+
+  // Declared before the buckets, which must release their memory first
+  std::shared_ptr<allocation::RegionPools> pools_;
+  std::vector<Bucket> buckets_;
+  // buckets_.size() - 1
+  size_t mask_;
+  size_t num_regions_;
+  stats::ProbeRecorder probes_;
+
+  // Creates the buckets of a table drawing from |pools|, bucket i from the
+  // pool of region i % num_regions
+  ChainedTable(size_t capacity, size_t num_regions,
+               std::shared_ptr<allocation::RegionPools> pools)
+      : pools_(std::move(pools)),
+        num_regions_(hashing::RoundUpToPowerOfTwo(num_regions)) {
+    size_t num_buckets =
+        hashing::RoundUpToPowerOfTwo(std::max(capacity, num_regions_));
+    if constexpr (allocation::kPooled<Allocator>) {
+      pools_->Reserve(num_regions_);
+    }
+    buckets_.reserve(num_buckets);
+    for (size_t i = 0; i < num_buckets; i++) {
+      buckets_.emplace_back(
+          pools_->Get<Allocator>(i & (num_regions_ - 1)));
+    }
+    mask_ = num_buckets - 1;
+  }
+
+  // Runs |work| on every region of this table through |for_each_index|, or
+  // serially if |rehashed| has fewer regions, as then two old regions share
+  // a new one
+  template <typename ForEachIndex, typename Work>
+  void ForEachOldRegion(const ChainedTable &rehashed,
+                       ForEachIndex for_each_index, Work work) const {
+    if (rehashed.num_regions_ >= num_regions_) {
+      for_each_index(num_regions_, work);
+    } else {
+      resizing::SerialFor()(num_regions_, work);
+    }
+  }
+
+  template <typename U> bool InsertImpl(size_t hash, U &&elem) {
+    Bucket &bucket = GetBucket(hash);
+    if (VectorContains(bucket, elem)) {
+      return false;
+    }
+    bucket.push_back(std::forward<U>(elem));
+    return true;
+  }
+
+  // Returns true iff an element equal to |key| is contained in a bucket
+  template <typename K>
+  bool VectorContains(const Bucket &v, const K &key) const {
+    for (auto it = v.begin(); it != v.end(); it++) {
+      if (KeyEqual()(*it, key)) {
+        probes_.Record(static_cast<size_t>(it - v.begin()) + 1);
+        return true;
+      }
+    }
+    probes_.Record(v.size());
+    return false;
+  }
+
+  // Returns corresponding bucket for elem based on it's hash
+  Bucket &GetBucket(size_t hash) {
+    return buckets_[hash & mask_];
+  }
+};
+
+#endif // CHAINED_TABLE_H
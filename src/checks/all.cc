@@ -1,10 +1,38 @@
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+
+#include "src/allocation.h"
+#include "src/hash_set_buffered.h"
 #include "src/hash_set_coarse_grained.h"
+#include "src/hash_set_cuckoo.h"
+#include "src/hash_set_lock_free.h"
 #include "src/hash_set_refinable.h"
 #include "src/hash_set_sequential.h"
+#include "src/hash_set_sharded.h"
 #include "src/hash_set_striped.h"
+#include "src/hash_set_striped_incremental.h"
+#include "src/hashing.h"
+#include "src/locking.h"
+#include "src/open_addressing_table.h"
+#include "src/snapshot.h"
+#include "src/swiss_table.h"
 
 namespace check_all {
 
+static_assert(IsHashSet<HashSetBuffered<int>, int>::value);
+static_assert(IsHashSet<HashSetCoarseGrained<int>, int>::value);
+static_assert(IsHashSet<HashSetCuckoo<int>, int>::value);
+static_assert(IsHashSet<HashSetLockFree<int>, int>::value);
+static_assert(IsHashSet<HashSetRefinable<int>, int>::value);
+static_assert(IsHashSet<HashSetSequential<int>, int>::value);
+static_assert(IsHashSet<HashSetSharded<int>, int>::value);
+static_assert(IsHashSet<HashSetStriped<int>, int>::value);
+static_assert(IsHashSet<HashSetStripedIncremental<int>, int>::value);
+static_assert(IsHashSet<HashSetBase<int>, int>::value);
+static_assert(!IsHashSet<ChainedTable<int>, int>::value);
+
 void Placeholder();
 
 void Placeholder() {
@@ -16,6 +44,54 @@ void Placeholder() {
     (void)hs.Contains(1);
   }
 
+  {
+    HashSetCoarseGrained<int, std::hash<int>, std::equal_to<int>,
+                         ChainedTable<int>, std::shared_mutex>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.SizeExact();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetCoarseGrained<int, std::hash<int>, std::equal_to<int>,
+                         ChainedTable<int>, locking::DistributedSharedMutex>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.SizeExact();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetCoarseGrained<int, std::hash<int>, std::equal_to<int>,
+                         OpenAddressingTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetCoarseGrained<int, std::hash<int>, std::equal_to<int>,
+                         SwissTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetLockFree<int> hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
   {
     HashSetRefinable<int> hs(16);
     hs.Add(1);
@@ -24,6 +100,26 @@ void Placeholder() {
     (void)hs.Contains(1);
   }
 
+  {
+    HashSetRefinable<int, std::hash<int>, std::equal_to<int>,
+                     OpenAddressingTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetRefinable<int, std::hash<int>, std::equal_to<int>,
+                     SwissTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
   {
     HashSetSequential<int> hs(16);
     hs.Add(1);
@@ -32,6 +128,100 @@ void Placeholder() {
     (void)hs.Contains(1);
   }
 
+  {
+    HashSetSequential<int, std::hash<int>, std::equal_to<int>,
+                      OpenAddressingTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetSequential<int, std::hash<int>, std::equal_to<int>,
+                      SwissTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetSequential<int> hs(16, {8, 1});
+    hs.Reserve(1000);
+    hs.Add(1);
+    hs.ShrinkToFit();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                   OpenAddressingTable<int>>
+        hs(16, 4, {0.5, 0.125});
+    hs.Reserve(1000);
+    hs.Add(1);
+    hs.ShrinkToFit();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetRefinable<int, std::hash<int>, std::equal_to<int>,
+                     SwissTable<int>>
+        hs(16);
+    hs.Reserve(1000);
+    hs.Add(1);
+    hs.ShrinkToFit();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                   OpenAddressingTable<int>>
+        hs(16);
+    hs.Add(1);
+    size_t sum = 0;
+    hs.ForEach([&](int elem) { sum += static_cast<size_t>(elem); });
+    HashSetBase<int>::Cursor cursor(hs);
+    while (const int *elem = cursor.Next()) {
+      sum += static_cast<size_t>(*elem);
+    }
+    (void)sum;
+  }
+
+  {
+    HashSetBuffered<int, std::hash<int>, std::equal_to<int>,
+                    HashSetCoarseGrained<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Flush();
+    hs.ForEach([](int /*elem*/) {});
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetSharded<int, std::hash<int>, std::equal_to<int>,
+                   HashSetLockFree<int>>
+        hs(16, {4, false});
+    hs.AddAll({1, 2, 3});
+    (void)hs.NodeOf(1);
+    hs.ForEach([](int /*elem*/) {});
+    (void)hs.ContainsMany({1, 4});
+    (void)snapshot::SaveSnapshot(hs, "sharded.snapshot");
+    (void)snapshot::LoadSnapshot(hs, "sharded.snapshot");
+  }
+
+  {
+    HashSetCuckoo<std::string> hs(16);
+    hs.Add("a");
+    hs.Reserve(1000);
+    hs.ForEach([](const std::string & /*elem*/) {});
+    (void)hs.Contains("a");
+    (void)snapshot::SaveSnapshot(hs, "cuckoo.snapshot");
+    (void)snapshot::LoadSnapshot(hs, "cuckoo.snapshot");
+  }
+
   {
     HashSetStriped<int> hs(16);
     hs.Add(1);
@@ -39,6 +229,124 @@ void Placeholder() {
     (void)hs.Size();
     (void)hs.Contains(1);
   }
+
+  {
+    HashSetStriped<int, hashing::MixingHash<int>> hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                   OpenAddressingTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                   SwissTable<int>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                   ChainedTable<int>, std::shared_mutex>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+    (void)hs.ContainsMany({1});
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>, SwissTable<int>,
+                   locking::DistributedSharedMutex>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+    (void)hs.ContainsMany({1});
+  }
+
+  {
+    HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                   ChainedTable<int, std::hash<int>, std::equal_to<int>,
+                                allocation::PoolAllocator<int>>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetRefinable<int, std::hash<int>, std::equal_to<int>,
+                     SwissTable<int, std::hash<int>, std::equal_to<int>,
+                                allocation::PoolAllocator<int>>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    HashSetSequential<int, std::hash<int>, std::equal_to<int>,
+                      OpenAddressingTable<int, std::hash<int>,
+                                          std::equal_to<int>,
+                                          allocation::PoolAllocator<int>>>
+        hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
+
+  {
+    using Equal = std::equal_to<>;
+    HashSetSequential<std::string, hashing::StringHash, Equal,
+                      ChainedTable<std::string, hashing::StringHash, Equal>>
+        sequential(16);
+    HashSetCoarseGrained<
+        std::string, hashing::StringHash, Equal,
+        OpenAddressingTable<std::string, hashing::StringHash, Equal>>
+        coarse_grained(16);
+    HashSetStriped<std::string, hashing::StringHash, Equal,
+                   SwissTable<std::string, hashing::StringHash, Equal>>
+        striped(16);
+    HashSetRefinable<std::string, hashing::StringHash, Equal,
+                     ChainedTable<std::string, hashing::StringHash, Equal>>
+        refinable(16);
+    std::string elem = "a";
+    sequential.Add(std::move(elem));
+    coarse_grained.Emplace(size_t{3}, 'b');
+    striped.Emplace("c");
+    refinable.Add("d");
+    (void)sequential.Contains(std::string_view("a"));
+    (void)coarse_grained.Contains(std::string_view("bbb"));
+    (void)striped.Contains("c");
+    (void)refinable.Contains(std::string("d"));
+  }
+
+  {
+    HashSetStripedIncremental<int> hs(16);
+    hs.Add(1);
+    hs.Remove(1);
+    (void)hs.Size();
+    (void)hs.Contains(1);
+  }
 }
 
 } // namespace check_all
@@ -0,0 +1,22 @@
+#include <memory>
+#include <vector>
+
+#include "src/allocation.h"
+
+namespace check_allocation {
+
+void Placeholder();
+
+void Placeholder() {
+  static_assert(allocation::kPooled<allocation::PoolAllocator<int>>);
+  static_assert(!allocation::kPooled<std::allocator<int>>);
+  allocation::RegionPools pools;
+  pools.Reserve(2);
+  std::vector<int, allocation::PoolAllocator<int>> pooled(
+      pools.Get<allocation::PoolAllocator<int>>(1));
+  pooled.push_back(1);
+  std::vector<int> plain(pools.Get<std::allocator<int>>(0));
+  plain.push_back(1);
+}
+
+} // namespace check_allocation
@@ -0,0 +1,21 @@
+#include "src/hash_set_buffered.h"
+
+namespace check_buffered {
+
+void Placeholder();
+
+void Placeholder() {
+  HashSetBuffered<int> hs(16, {64, std::chrono::microseconds(100)});
+  hs.Add(1);
+  hs.Remove(1);
+  (void)hs.Size();
+  (void)hs.SizeExact();
+  (void)hs.Contains(1);
+  hs.AddAll({1, 2});
+  hs.RemoveAll({1});
+  (void)hs.ContainsMany({2});
+  hs.Flush();
+  (void)hs.Duplicates();
+}
+
+} // namespace check_buffered
@@ -9,7 +9,11 @@ void Placeholder() {
   hs.Add(1);
   hs.Remove(1);
   (void)hs.Size();
+  (void)hs.SizeExact();
   (void)hs.Contains(1);
+  hs.AddAll({1, 2});
+  hs.RemoveAll({1});
+  (void)hs.ContainsMany({2});
 }
 
 } // namespace check_coarse_grained
@@ -0,0 +1,20 @@
+#include "src/hash_set_cuckoo.h"
+
+namespace check_cuckoo {
+
+void Placeholder();
+
+void Placeholder() {
+  HashSetCuckoo<int> hs(16, 4);
+  hs.Add(1);
+  hs.Remove(1);
+  (void)hs.Size();
+  (void)hs.SizeExact();
+  (void)hs.Contains(1);
+  hs.AddAll({1, 2});
+  hs.RemoveAll({1});
+  (void)hs.ContainsMany({2});
+  hs.Reserve(100);
+}
+
+} // namespace check_cuckoo
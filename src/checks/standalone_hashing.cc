@@ -0,0 +1,13 @@
+#include "src/hashing.h"
+
+namespace check_hashing {
+
+void Placeholder();
+
+void Placeholder() {
+  (void)hashing::MixingHash<int>()(1);
+  (void)hashing::Mix64(1);
+  (void)hashing::Log2(hashing::RoundUpToPowerOfTwo(5));
+}
+
+} // namespace check_hashing
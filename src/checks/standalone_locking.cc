@@ -0,0 +1,29 @@
+#include <mutex>
+#include <shared_mutex>
+
+#include "src/locking.h"
+
+namespace check_locking {
+
+void Placeholder();
+
+void Placeholder() {
+  static_assert(!locking::IsShared<std::mutex>::value);
+  static_assert(locking::IsShared<std::shared_mutex>::value);
+  static_assert(locking::IsShared<locking::DistributedSharedMutex>::value);
+  locking::DistributedSharedMutex mutex;
+  {
+    locking::ReadGuard<locking::DistributedSharedMutex> guard(mutex);
+  }
+  {
+    std::scoped_lock<locking::DistributedSharedMutex> guard(mutex);
+  }
+  if (mutex.try_lock_shared()) {
+    mutex.unlock_shared();
+  }
+  if (mutex.try_lock()) {
+    mutex.unlock();
+  }
+}
+
+} // namespace check_locking
@@ -0,0 +1,17 @@
+#include "src/open_addressing_table.h"
+
+namespace check_open_addressing_table {
+
+void Placeholder();
+
+void Placeholder() {
+  OpenAddressingTable<int> table(16, 4);
+  (void)table.Insert(1, 1);
+  (void)table.Erase(1, 1);
+  (void)table.Full(1);
+  (void)table.Contains(1, 1);
+  table.Grow();
+  (void)table.Capacity();
+}
+
+} // namespace check_open_addressing_table
@@ -0,0 +1,20 @@
+#include <memory>
+
+#include "src/reclamation.h"
+
+namespace check_reclamation {
+
+void Placeholder();
+
+void Placeholder() {
+  reclamation::EpochDomain domain;
+  {
+    auto guard = domain.Pin();
+    domain.Retire(new int(1));
+  }
+  domain.Retire(std::make_unique<int>(2));
+  domain.Collect();
+  (void)domain.Pending();
+}
+
+} // namespace check_reclamation
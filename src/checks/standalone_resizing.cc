@@ -0,0 +1,20 @@
+#include "src/resizing.h"
+
+namespace check_resizing {
+
+void Placeholder();
+
+void Placeholder() {
+  resizing::LoadFactorPolicy policy = resizing::LoadFactorPolicy{4, 0.5}.For(1);
+  (void)policy.ShouldGrow(2, 1);
+  (void)policy.ShouldShrink(1, 64, 16);
+  (void)policy.ShrunkCapacity(1, 64, 16);
+  (void)policy.CapacityFor(100, 16);
+
+  size_t sum = 0;
+  resizing::SerialFor()(4, [&](size_t i) { sum += i; });
+  resizing::ParallelFor parallel_for(resizing::RehashWorkers(sum));
+  parallel_for(4, [](size_t /*i*/) {});
+}
+
+} // namespace check_resizing
@@ -9,6 +9,7 @@ void Placeholder() {
   hs.Add(1);
   hs.Remove(1);
   (void)hs.Size();
+  (void)hs.SizeExact();
   (void)hs.Contains(1);
 }
 
@@ -0,0 +1,25 @@
+#include "src/hash_set_sharded.h"
+
+namespace check_sharded {
+
+void Placeholder();
+
+void Placeholder() {
+  HashSetSharded<int> hs(16, {2, true});
+  hs.Add(1);
+  hs.Remove(1);
+  (void)hs.Size();
+  (void)hs.SizeExact();
+  (void)hs.Contains(1);
+  hs.AddAll({1, 2});
+  hs.RemoveAll({1});
+  (void)hs.ContainsMany({2});
+  hs.Reserve(100);
+  hs.ShrinkToFit();
+  (void)hs.NumShards();
+  (void)hs.NodeOf(2);
+  (void)numa::NumNodes();
+  (void)numa::CurrentNode();
+}
+
+} // namespace check_sharded
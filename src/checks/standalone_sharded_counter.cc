@@ -0,0 +1,14 @@
+#include "src/sharded_counter.h"
+
+namespace check_sharded_counter {
+
+void Placeholder();
+
+void Placeholder() {
+  ShardedCounter counter;
+  (void)counter.Increment();
+  counter.Decrement();
+  (void)counter.Sum();
+}
+
+} // namespace check_sharded_counter
@@ -0,0 +1,37 @@
+#include <string>
+#include <vector>
+
+#include "src/snapshot.h"
+
+namespace check_snapshot {
+
+void Placeholder();
+
+// Stands in for a hash set, with the operations snapshots use
+struct Elements {
+  std::vector<std::string> elems;
+
+  template <typename Visit> void ForEach(Visit visit) {
+    for (const auto &elem : elems) {
+      visit(elem);
+    }
+  }
+
+  [[nodiscard]] size_t Size() const { return elems.size(); }
+
+  void Reserve(size_t capacity) { elems.reserve(capacity); }
+
+  size_t AddAll(const std::vector<std::string> &batch) {
+    elems.insert(elems.end(), batch.begin(), batch.end());
+    return batch.size();
+  }
+};
+
+void Placeholder() {
+  Elements elements;
+  (void)snapshot::Save<std::string>(elements, "snapshot");
+  (void)snapshot::Load<std::string>(elements, "snapshot");
+  (void)snapshot::Valid<int>(snapshot::Header{});
+}
+
+} // namespace check_snapshot
@@ -0,0 +1,30 @@
+#include <iostream>
+
+#include "src/stats.h"
+
+namespace check_stats {
+
+void Placeholder();
+
+void Placeholder() {
+  stats::Mutex mutex;
+  mutex.lock();
+  mutex.unlock();
+  stats::Snapshot snapshot;
+  snapshot.locks.push_back(stats::CountsOf(mutex));
+  stats::ProbeHistogram probes;
+  stats::ProbeRecorder recorder;
+  recorder.Attach(&probes);
+  recorder.Record(1);
+  probes.CopyTo(&snapshot);
+  stats::ResizeCounters resizes;
+  {
+    stats::ResizeScope scope(&resizes);
+    scope.Exclusive();
+  }
+  resizes.CopyTo(&snapshot);
+  snapshot.Merge(stats::Snapshot());
+  stats::Print(std::cout, snapshot);
+}
+
+} // namespace check_stats
@@ -5,11 +5,15 @@ namespace check_striped {
 void Placeholder();
 
 void Placeholder() {
-  HashSetStriped<int> hs(16);
+  HashSetStriped<int> hs(16, 4);
   hs.Add(1);
   hs.Remove(1);
   (void)hs.Size();
+  (void)hs.SizeExact();
   (void)hs.Contains(1);
+  hs.AddAll({1, 2});
+  hs.RemoveAll({1});
+  (void)hs.ContainsMany({2});
 }
 
 } // namespace check_striped
@@ -0,0 +1,16 @@
+#include "src/hash_set_striped_incremental.h"
+
+namespace check_striped_incremental {
+
+void Placeholder();
+
+void Placeholder() {
+  HashSetStripedIncremental<int> hs(16);
+  hs.Add(1);
+  hs.Remove(1);
+  (void)hs.Size();
+  (void)hs.SizeExact();
+  (void)hs.Contains(1);
+}
+
+} // namespace check_striped_incremental
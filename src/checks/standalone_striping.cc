@@ -0,0 +1,16 @@
+#include "src/striping.h"
+
+namespace check_striping {
+
+void Placeholder();
+
+void Placeholder() {
+  striping::Stripe<> stripe;
+  stripe.mutex.lock();
+  stripe.version++;
+  stripe.mutex.unlock();
+  (void)striping::DefaultStripeCount();
+  (void)striping::ThreadIndex(8);
+}
+
+} // namespace check_striping
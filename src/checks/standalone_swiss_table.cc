@@ -0,0 +1,17 @@
+#include "src/swiss_table.h"
+
+namespace check_swiss_table {
+
+void Placeholder();
+
+void Placeholder() {
+  SwissTable<int> table(16, 4);
+  (void)table.Insert(1, 1);
+  (void)table.Erase(1, 1);
+  (void)table.Full(1);
+  (void)table.Contains(1, 1);
+  table.Grow();
+  (void)table.Capacity();
+}
+
+} // namespace check_swiss_table
@@ -0,0 +1,10 @@
+#include "src/benchmark.h"
+#include "src/hash_set_coarse_grained.h"
+#include "src/open_addressing_table.h"
+
+int main(int argc, char **argv) {
+  using HashSetType =
+      HashSetCoarseGrained<int, std::hash<int>, std::equal_to<int>,
+                           OpenAddressingTable<int>>;
+  return benchmark::RunBenchmark<HashSetType>(argc, argv);
+}
@@ -0,0 +1,6 @@
+#include "src/benchmark.h"
+#include "src/hash_set_lock_free.h"
+
+int main(int argc, char **argv) {
+  return benchmark::RunBenchmark<HashSetLockFree<int>>(argc, argv);
+}
@@ -1,16 +1,12 @@
 #include <iostream>
 
 #include "src/hash_set_sequential.h"
+#include "src/open_addressing_table.h"
+#include "src/swiss_table.h"
 
-int main(int argc, char **argv) {
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << " initial_capacity count" << std::endl;
-    return 1;
-  }
-  size_t initial_capacity = std::stoul(std::string(argv[1]));
-  size_t count = std::stoul(std::string(argv[2]));
-
-  HashSetSequential<int> sequential_set(initial_capacity);
+template <typename HashSetType>
+static int RunTests(size_t initial_capacity, size_t count) {
+  HashSetType sequential_set(initial_capacity);
 
   for (size_t i = 0; i < count; i++) {
     sequential_set.Add(static_cast<int>(i));
@@ -37,6 +33,31 @@ int main(int argc, char **argv) {
               << sequential_set.Size() << std::endl;
     return 1;
   }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " initial_capacity count" << std::endl;
+    return 1;
+  }
+  size_t initial_capacity = std::stoul(std::string(argv[1]));
+  size_t count = std::stoul(std::string(argv[2]));
+
+  if (RunTests<HashSetSequential<int>>(initial_capacity, count) != 0) {
+    return 1;
+  }
+  using Hash = std::hash<int>;
+  using KeyEqual = std::equal_to<int>;
+  if (RunTests<HashSetSequential<int, Hash, KeyEqual,
+                                 OpenAddressingTable<int>>>(initial_capacity,
+                                                            count) != 0) {
+    return 1;
+  }
+  if (RunTests<HashSetSequential<int, Hash, KeyEqual, SwissTable<int>>>(
+          initial_capacity, count) != 0) {
+    return 1;
+  }
 
   std::cout << "Sequential hash set tests succeeded" << std::endl;
 
@@ -0,0 +1,6 @@
+#include "src/benchmark.h"
+#include "src/hash_set_striped_incremental.h"
+
+int main(int argc, char **argv) {
+  return benchmark::RunBenchmark<HashSetStripedIncremental<int>>(argc, argv);
+}
@@ -0,0 +1,10 @@
+#include "src/benchmark.h"
+#include "src/hash_set_striped.h"
+#include "src/swiss_table.h"
+
+int main(int argc, char **argv) {
+  using HashSetType =
+      HashSetStriped<int, std::hash<int>, std::equal_to<int>,
+                     SwissTable<int>>;
+  return benchmark::RunBenchmark<HashSetType>(argc, argv);
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "src/allocation.h"
+#include "src/hash_set_buffered.h"
+#include "src/hash_set_coarse_grained.h"
+#include "src/hash_set_cuckoo.h"
+#include "src/hash_set_lock_free.h"
+#include "src/hash_set_refinable.h"
+#include "src/hash_set_sequential.h"
+#include "src/hash_set_sharded.h"
+#include "src/hash_set_striped.h"
+#include "src/hash_set_striped_incremental.h"
+#include "src/locking.h"
+#include "src/open_addressing_table.h"
+#include "src/swiss_table.h"
+#include "src/workload.h"
+
+namespace {
+
+// Runs the workload on |HashSetType| at every thread count, unless the
+// options leave |name| out. Sets that are not thread safe only run on one
+// thread, which is what speedups are measured against. Runs through
+// HashSetBase are reported as "|name|/virtual"
+template <typename HashSetType>
+void Run(const std::string &name, const workload::Options &options,
+         workload::Report *report, bool thread_safe = true) {
+  if (!options.sets.empty() &&
+      std::find(options.sets.begin(), options.sets.end(), name) ==
+          options.sets.end()) {
+    return;
+  }
+  std::vector<size_t> thread_counts = {1};
+  if (thread_safe) {
+    thread_counts = workload::ThreadCounts(options);
+  }
+  std::vector<workload::Dispatch> dispatches = {options.dispatch};
+  if (options.dispatch == workload::Dispatch::kBoth) {
+    dispatches = {workload::Dispatch::kStatic, workload::Dispatch::kVirtual};
+  }
+  for (workload::Dispatch dispatch : dispatches) {
+    std::string point_name = name;
+    if (dispatch == workload::Dispatch::kVirtual) {
+      point_name += "/virtual";
+    }
+    for (size_t num_threads : thread_counts) {
+      workload::Options point = options;
+      point.num_threads = num_threads;
+      point.dispatch = dispatch;
+      std::vector<workload::Result> results;
+      for (size_t i = 0; i < options.repetitions; i++) {
+        results.push_back(workload::RunWorkload<HashSetType>(point));
+      }
+      report->Add(point_name, num_threads, results);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  workload::Options options;
+  if (!workload::ParseOptions(argc, argv, &options)) {
+    return 1;
+  }
+  workload::Report report(options);
+  using Hash = std::hash<int>;
+  using KeyEqual = std::equal_to<int>;
+  Run<HashSetSequential<int>>("sequential", options, &report, false);
+  Run<HashSetCoarseGrained<int>>("coarse_grained", options, &report);
+  Run<HashSetCoarseGrained<int, Hash, KeyEqual,
+                           ChainedTable<int, Hash, KeyEqual,
+                                        allocation::PoolAllocator<int>>>>(
+      "coarse_grained_pooled", options, &report);
+  Run<HashSetCoarseGrained<int, Hash, KeyEqual, OpenAddressingTable<int>>>(
+      "coarse_grained_open_addressing", options, &report);
+  Run<HashSetCoarseGrained<int, Hash, KeyEqual, SwissTable<int>>>(
+      "coarse_grained_swiss", options, &report);
+  Run<HashSetCoarseGrained<int, Hash, KeyEqual, ChainedTable<int>,
+                           std::shared_mutex>>("coarse_grained_shared_mutex",
+                                               options, &report);
+  Run<HashSetCoarseGrained<int, Hash, KeyEqual, ChainedTable<int>,
+                           locking::DistributedSharedMutex>>(
+      "coarse_grained_distributed_shared_mutex", options, &report);
+  Run<HashSetStriped<int>>("striped", options, &report);
+  Run<HashSetStriped<int, Hash, KeyEqual,
+                     ChainedTable<int, Hash, KeyEqual,
+                                  allocation::PoolAllocator<int>>>>(
+      "striped_pooled", options, &report);
+  Run<HashSetStriped<int, Hash, KeyEqual, OpenAddressingTable<int>>>(
+      "striped_open_addressing", options, &report);
+  Run<HashSetStriped<int, Hash, KeyEqual, SwissTable<int>>>(
+      "striped_swiss", options, &report);
+  Run<HashSetStriped<int, Hash, KeyEqual, ChainedTable<int>,
+                     std::shared_mutex>>("striped_shared_mutex", options,
+                                         &report);
+  Run<HashSetStriped<int, Hash, KeyEqual, ChainedTable<int>,
+                     locking::DistributedSharedMutex>>(
+      "striped_distributed_shared_mutex", options, &report);
+  Run<HashSetRefinable<int>>("refinable", options, &report);
+  Run<HashSetRefinable<int, Hash, KeyEqual, SwissTable<int>>>(
+      "refinable_swiss", options, &report);
+  Run<HashSetLockFree<int>>("lock_free", options, &report);
+  Run<HashSetCuckoo<int>>("cuckoo", options, &report);
+  Run<HashSetBuffered<int, Hash, KeyEqual, HashSetCoarseGrained<int>>>(
+      "coarse_grained_buffered", options, &report);
+  Run<HashSetBuffered<int>>("striped_buffered", options, &report);
+  Run<HashSetSharded<int>>("sharded", options, &report);
+  Run<HashSetSharded<int, Hash, KeyEqual, HashSetLockFree<int>>>(
+      "sharded_lock_free", options, &report);
+  Run<HashSetStripedIncremental<int>>("striped_incremental", options,
+                                      &report);
+  report.Finish();
+  return 0;
+}
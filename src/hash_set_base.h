@@ -2,24 +2,184 @@
 #define HASH_SET_BASE_H
 
 #include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "src/stats.h"
+
+// Interface of the hash sets, for code that picks a set at runtime. Every set
+// marks its overrides final, so code templated on the concrete set type, and
+// checked with IsHashSet, gets direct calls that can be inlined instead.
 template <typename T> class HashSetBase {
 public:
   virtual ~HashSetBase() = default;
 
   // Adds |elem| to the hash set. Returns true if |elem| was absent, and false
-  // otherwise.
+  // otherwise. |elem| is moved into the set, so callers that no longer need it
+  // should pass it with std::move.
   virtual bool Add(T elem) = 0;
 
   // Removes |elem| from the hash set. Returns true if |elem| was present, and
   // false otherwise.
-  virtual bool Remove(T elem) = 0;
+  virtual bool Remove(const T &elem) = 0;
 
   // Returns true if |elem| is present in the hash set, and false otherwise.
-  [[nodiscard]] virtual bool Contains(T elem) = 0;
+  [[nodiscard]] virtual bool Contains(const T &elem) = 0;
+
+  // Adds the element constructed from |args|, as Add does.
+  template <typename... Args> bool Emplace(Args &&...args) {
+    return Add(T(std::forward<Args>(args)...));
+  }
 
-  // Returns the size of the hash set.
+  // Returns the size of the hash set. Sets that spread their count over several
+  // counters may be off while other threads are modifying the set.
   [[nodiscard]] virtual size_t Size() const = 0;
+
+  // Returns the size of the hash set without the error Size() may have under
+  // concurrent modification. Sets that can pause every writer do so, which may
+  // block other operations; the others return Size().
+  [[nodiscard]] virtual size_t SizeExact() { return Size(); }
+
+  // Returns a snapshot of the statistics the set collects when built with
+  // HASH_SET_STATS. Sets without instrumentation return an empty snapshot.
+  [[nodiscard]] virtual stats::Snapshot Stats() const { return {}; }
+
+  // Adds every element of |elems| to the hash set. Returns the number of
+  // elements that were absent. Implementations may reorder the insertions.
+  virtual size_t AddAll(const std::vector<T> &elems) {
+    size_t added = 0;
+    for (const T &elem : elems) {
+      if (Add(elem)) {
+        added++;
+      }
+    }
+    return added;
+  }
+
+  // Removes every element of |elems| from the hash set. Returns the number of
+  // elements that were present.
+  virtual size_t RemoveAll(const std::vector<T> &elems) {
+    size_t removed = 0;
+    for (const T &elem : elems) {
+      if (Remove(elem)) {
+        removed++;
+      }
+    }
+    return removed;
+  }
+
+  // Returns, for every element of |elems|, whether it is present in the hash
+  // set.
+  [[nodiscard]] virtual std::vector<bool>
+  ContainsMany(const std::vector<T> &elems) {
+    std::vector<bool> result(elems.size());
+    for (size_t i = 0; i < elems.size(); i++) {
+      result[i] = Contains(elems[i]);
+    }
+    return result;
+  }
+
+  // Makes room for |capacity| elements, so that the set does not resize until
+  // it holds more. Sets whose storage cannot be resized on demand do nothing.
+  virtual void Reserve(size_t /*capacity*/) {}
+
+  // Shrinks the storage to the smallest capacity that holds the current
+  // elements, but not below the initial capacity. Sets whose storage never
+  // shrinks do nothing.
+  virtual void ShrinkToFit() {}
+
+  // Calls |visit| on every element. The traversal is weakly consistent: it
+  // runs alongside writers, visits every element present throughout exactly
+  // once, and may or may not visit elements added or removed meanwhile. The
+  // set is copied one part at a time, holding only the locks of that part,
+  // and |visit| runs once they are released, so it may call into the set.
+  template <typename Visit> void ForEach(Visit visit) {
+    std::vector<T> part;
+    size_t num_parts = NumParts();
+    for (size_t i = 0; i < num_parts; i++) {
+      part.clear();
+      CopyPart(i, num_parts, &part);
+      for (const T &elem : part) {
+        visit(elem);
+      }
+    }
+  }
+
+  // Pulls the elements of a set one at a time, with the same consistency as
+  // ForEach, for callers that cannot hand over a callback. Only one part of
+  // the set is held in memory at a time.
+  class Cursor {
+  public:
+    explicit Cursor(HashSetBase &set) : set_(set), num_parts_(set.NumParts()) {}
+
+    // Returns the next element, or nullptr once every element was visited.
+    // The element stays valid until the next call.
+    const T *Next() {
+      while (next_ == part_.size()) {
+        if (next_part_ == num_parts_) {
+          return nullptr;
+        }
+        part_.clear();
+        next_ = 0;
+        set_.CopyPart(next_part_++, num_parts_, &part_);
+      }
+      return &part_[next_++];
+    }
+
+  private:
+    HashSetBase &set_;
+    size_t num_parts_;
+    size_t next_part_ = 0;
+    std::vector<T> part_;
+    size_t next_ = 0;
+  };
+
+protected:
+  // Returns the number of parts ForEach walks the set in. The count may
+  // change as the set resizes, but CopyPart still takes the count returned
+  // when the walk began.
+  [[nodiscard]] virtual size_t NumParts() = 0;
+
+  // Appends part |part| of the set, split into |num_parts| parts by an
+  // earlier NumParts(), to |out|. Every element belongs to exactly one part,
+  // whatever resizes happen during the walk.
+  virtual void CopyPart(size_t part, size_t num_parts, std::vector<T> *out) = 0;
+
+  // Let sets that wrap another set walk it in the parts of that set
+  static size_t NumPartsOf(HashSetBase &set) { return set.NumParts(); }
+
+  static void CopyPartOf(HashSetBase &set, size_t part, size_t num_parts,
+                         std::vector<T> *out) {
+    set.CopyPart(part, num_parts, out);
+  }
 };
 
+// True if |HashSetType| has the operations of a hash set of |T| declared by
+// HashSetBase, whether or not it derives from it
+template <typename HashSetType, typename T, typename = void>
+struct IsHashSet : std::false_type {};
+
+template <typename HashSetType, typename T>
+struct IsHashSet<
+    HashSetType, T,
+    std::void_t<
+        decltype(bool{std::declval<HashSetType &>().Add(std::declval<T>())}),
+        decltype(bool{
+            std::declval<HashSetType &>().Remove(std::declval<const T &>())}),
+        decltype(bool{
+            std::declval<HashSetType &>().Contains(std::declval<const T &>())}),
+        decltype(size_t{std::declval<const HashSetType &>().Size()}),
+        decltype(size_t{std::declval<HashSetType &>().SizeExact()}),
+        decltype(size_t{std::declval<HashSetType &>().AddAll(
+            std::declval<const std::vector<T> &>())}),
+        decltype(size_t{std::declval<HashSetType &>().RemoveAll(
+            std::declval<const std::vector<T> &>())}),
+        decltype(std::declval<HashSetType &>().Reserve(size_t{})),
+        decltype(std::declval<HashSetType &>().ShrinkToFit()),
+        decltype(std::declval<HashSetType &>().ForEach(
+            std::declval<void (*)(const T &)>())),
+        decltype(std::vector<bool>{std::declval<HashSetType &>().ContainsMany(
+            std::declval<const std::vector<T> &>())})>> : std::true_type {};
+
 #endif // HASH_SET_BASE_H
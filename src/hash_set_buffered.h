@@ -0,0 +1,364 @@
+#ifndef HASH_SET_BUFFERED_H
+#define HASH_SET_BUFFERED_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/hash_set_base.h"
+#include "src/hash_set_striped.h"
+#include "src/hashing.h"
+#include "src/stats.h"
+#include "src/striping.h"
+
+// When the per-thread buffers of HashSetBuffered are handed to the set
+namespace buffering {
+
+// A buffer is flushed once it holds |batch_size| elements, or once its oldest
+// element waited |max_delay|, by the next insertion into it or by the flusher
+// thread of the set. A zero |max_delay| starts no flusher thread
+struct FlushPolicy {
+  size_t batch_size = 256;
+  std::chrono::microseconds max_delay{1000};
+};
+
+} // namespace buffering
+
+// Write-combining front end over |Inner|, a thread safe hash set such as
+// HashSetStriped or HashSetCoarseGrained that hashes and compares elements
+// with |Hash| and |KeyEqual|. Add only appends the element to the buffer of
+// the calling thread, and a flushed buffer is handed to Inner::AddAll, which
+// takes every lock once for the whole batch; striped sets group the batch by
+// stripe first.
+//
+// An element is visible to the thread that added it at once, but to other
+// threads only once its buffer is flushed: when it fills up, when its oldest
+// element waited too long, see buffering::FlushPolicy, or on Flush(). A thread
+// owned by the set checks every buffer twice per max_delay, so the elements of
+// a thread that went quiet or exited wait about 1.5 max_delay at most. Add
+// takes no lock of the set, so it only returns false for an element already in
+// the buffer of the calling thread; whether the set held it is only known at
+// the flush, which counts such elements in Duplicates(). Remove, AddAll and
+// RemoveAll flush the buffer of the calling thread first, so every thread sees
+// its own operations in order. Size() only counts flushed elements.
+//
+// Every thread gets a buffer of its own on its first insertion, registered
+// with the set. Each buffer has a lock, which is only contended when another
+// thread flushes it.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Inner = HashSetStriped<T, Hash, KeyEqual>>
+class HashSetBuffered : public HashSetBase<T> {
+public:
+  explicit HashSetBuffered(size_t initial_capacity,
+                           buffering::FlushPolicy policy = {})
+      : inner_(initial_capacity), policy_(policy), id_(NextId()) {
+    if (policy_.max_delay.count() > 0) {
+      flusher_ = std::thread([this] { RunFlusher(); });
+    }
+  }
+
+  // Stops the flusher thread. Elements still buffered are dropped with the
+  // set
+  ~HashSetBuffered() override {
+    {
+      std::scoped_lock<std::mutex> flusherLock(flusher_mutex_);
+      stopping_ = true;
+    }
+    flusher_wake_.notify_one();
+    if (flusher_.joinable()) {
+      flusher_.join();
+    }
+  }
+
+  // Buffers |elem| unless the buffer already holds it, and flushes the buffer
+  // if the policy says so
+  bool Add(T elem) final {
+    size_t elem_hash = Hash()(elem);
+    Buffer &buffer = OwnBuffer();
+    std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+    if (buffer.Contains(elem_hash, elem)) {
+      return false;
+    }
+    Clock::time_point now = Clock::now();
+    if (buffer.elems.empty()) {
+      buffer.oldest = now;
+    }
+    buffer.Push(elem_hash, std::move(elem));
+    if (buffer.elems.size() >= policy_.batch_size ||
+        now - buffer.oldest >= policy_.max_delay) {
+      FlushLocked(buffer);
+    }
+    return true;
+  }
+
+  // Flushes the buffer of the calling thread, then removes |elem| from the
+  // set
+  bool Remove(const T &elem) final {
+    Buffer &buffer = OwnBuffer();
+    std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+    FlushLocked(buffer);
+    return inner_.Remove(elem);
+  }
+
+  // Looks in the buffer of the calling thread before the set. Elements
+  // buffered by other threads are not found until they are flushed
+  [[nodiscard]] bool Contains(const T &elem) final {
+    {
+      Buffer &buffer = OwnBuffer();
+      std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+      if (buffer.Contains(Hash()(elem), elem)) {
+        return true;
+      }
+    }
+    return inner_.Contains(elem);
+  }
+
+  // Returns the number of flushed elements
+  [[nodiscard]] size_t Size() const final { return inner_.Size(); }
+
+  // Flushes every buffer, then returns the exact size of the set
+  [[nodiscard]] size_t SizeExact() final {
+    Flush();
+    return inner_.SizeExact();
+  }
+
+  [[nodiscard]] stats::Snapshot Stats() const final { return inner_.Stats(); }
+
+  // Hands the elements of |elems| straight to the set, which already batches
+  // them, once the buffer of the calling thread is flushed
+  size_t AddAll(const std::vector<T> &elems) final {
+    FlushOwn();
+    return inner_.AddAll(elems);
+  }
+
+  size_t RemoveAll(const std::vector<T> &elems) final {
+    FlushOwn();
+    return inner_.RemoveAll(elems);
+  }
+
+  // Looks in the buffer of the calling thread before the set
+  [[nodiscard]] std::vector<bool>
+  ContainsMany(const std::vector<T> &elems) final {
+    std::vector<bool> buffered(elems.size());
+    {
+      Buffer &buffer = OwnBuffer();
+      std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+      for (size_t i = 0; i < elems.size(); i++) {
+        buffered[i] = buffer.Contains(Hash()(elems[i]), elems[i]);
+      }
+    }
+    std::vector<bool> result = inner_.ContainsMany(elems);
+    for (size_t i = 0; i < elems.size(); i++) {
+      result[i] = result[i] || buffered[i];
+    }
+    return result;
+  }
+
+  void Reserve(size_t capacity) final { inner_.Reserve(capacity); }
+
+  void ShrinkToFit() final {
+    Flush();
+    inner_.ShrinkToFit();
+  }
+
+  // Hands every buffer to the set, making every element added so far visible
+  // to all threads. Returns the number of elements the set did not hold yet
+  size_t Flush() {
+    size_t added = 0;
+    std::scoped_lock<std::mutex> registryLock(registry_mutex_);
+    for (auto &entry : buffers_) {
+      Buffer &buffer = *entry.second;
+      std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+      added += FlushLocked(buffer);
+    }
+    return added;
+  }
+
+  // Returns the number of buffered elements the set already held when they
+  // were flushed, for which Add returned true
+  [[nodiscard]] size_t Duplicates() const {
+    return duplicates_.load(std::memory_order_relaxed);
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // Holds at most |batch_size| elements, as it is flushed once full
+  struct alignas(striping::kCacheLineSize) Buffer {
+    explicit Buffer(size_t batch_size)
+        : slots(hashing::RoundUpToPowerOfTwo(
+              2 * std::max(batch_size, size_t{1}))) {}
+
+    std::mutex mutex;
+    std::vector<T> elems;
+    // Hash of every element of |elems|, so that lookups rarely compare
+    // elements
+    std::vector<size_t> hashes;
+    // Linear probing index of |elems| by hash, holding one more than the
+    // position of an element, or 0 in an empty slot. At most half full
+    std::vector<uint32_t> slots;
+    // When the first element of |elems| was buffered
+    Clock::time_point oldest;
+
+    size_t FirstSlot(size_t hash) const {
+      return static_cast<size_t>(hashing::Mix64(hash)) & (slots.size() - 1);
+    }
+
+    bool Contains(size_t hash, const T &elem) const {
+      for (size_t i = FirstSlot(hash); slots[i] != 0;
+           i = (i + 1) & (slots.size() - 1)) {
+        size_t position = slots[i] - 1;
+        if (hashes[position] == hash && KeyEqual()(elems[position], elem)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Appends |elem|, which must not be buffered yet
+    void Push(size_t hash, T elem) {
+      size_t i = FirstSlot(hash);
+      while (slots[i] != 0) {
+        i = (i + 1) & (slots.size() - 1);
+      }
+      elems.push_back(std::move(elem));
+      hashes.push_back(hash);
+      slots[i] = static_cast<uint32_t>(elems.size());
+    }
+
+    void Clear() {
+      elems.clear();
+      hashes.clear();
+      std::fill(slots.begin(), slots.end(), 0);
+    }
+  };
+
+  // Sets a thread remembers its buffer in, replaced in turn
+  static constexpr size_t kCachedSets = 4;
+
+  // Buffer of a thread in the set with id |set_id|
+  struct CachedBuffer {
+    uint64_t set_id = 0;
+    Buffer *buffer = nullptr;
+  };
+
+  struct BufferCache {
+    std::array<CachedBuffer, kCachedSets> entries;
+    size_t next = 0;
+  };
+
+  Inner inner_;
+  buffering::FlushPolicy policy_;
+  // Never reused, so a thread cannot mistake a buffer of a destroyed set for
+  // one of this set
+  const uint64_t id_;
+  // Buffer of every thread that added to the set. Buffers are only freed
+  // with the set
+  std::mutex registry_mutex_;
+  std::unordered_map<std::thread::id, std::unique_ptr<Buffer>> buffers_;
+  std::atomic<size_t> duplicates_{0};
+  std::mutex flusher_mutex_;
+  std::condition_variable flusher_wake_;
+  bool stopping_ = false;
+  // Started last, once every member it uses is built
+  std::thread flusher_;
+
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> next_id{1};
+    return next_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Returns the buffer of the calling thread, registering one on its first
+  // use. Threads remember their buffers in the last few sets they used, so
+  // the registry is only locked on a miss
+  Buffer &OwnBuffer() {
+    static thread_local BufferCache cache;
+    for (const auto &entry : cache.entries) {
+      if (entry.set_id == id_) {
+        return *entry.buffer;
+      }
+    }
+    Buffer *buffer = nullptr;
+    {
+      std::scoped_lock<std::mutex> registryLock(registry_mutex_);
+      std::unique_ptr<Buffer> &owned = buffers_[std::this_thread::get_id()];
+      if (owned == nullptr) {
+        owned = std::make_unique<Buffer>(policy_.batch_size);
+      }
+      buffer = owned.get();
+    }
+    cache.entries[cache.next] = {id_, buffer};
+    cache.next = (cache.next + 1) % kCachedSets;
+    return *buffer;
+  }
+
+  // Hands |buffer| to the set and returns the number of its elements the set
+  // did not hold yet. Must hold its lock, which keeps its thread from seeing
+  // its elements in neither place while another thread flushes
+  size_t FlushLocked(Buffer &buffer) {
+    if (buffer.elems.empty()) {
+      return 0;
+    }
+    size_t added = inner_.AddAll(buffer.elems);
+    duplicates_.fetch_add(buffer.elems.size() - added,
+                          std::memory_order_relaxed);
+    buffer.Clear();
+    return added;
+  }
+
+  // Flushes, every half max_delay, the buffers whose oldest element waited
+  // max_delay, until the set is destroyed
+  void RunFlusher() {
+    auto period = std::max(policy_.max_delay / 2, std::chrono::microseconds(1));
+    std::unique_lock<std::mutex> flusherLock(flusher_mutex_);
+    while (!flusher_wake_.wait_for(flusherLock, period,
+                                   [this] { return stopping_; })) {
+      flusherLock.unlock();
+      FlushExpired();
+      flusherLock.lock();
+    }
+  }
+
+  void FlushExpired() {
+    Clock::time_point now = Clock::now();
+    std::scoped_lock<std::mutex> registryLock(registry_mutex_);
+    for (auto &entry : buffers_) {
+      Buffer &buffer = *entry.second;
+      std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+      if (!buffer.elems.empty() && now - buffer.oldest >= policy_.max_delay) {
+        FlushLocked(buffer);
+      }
+    }
+  }
+
+  void FlushOwn() {
+    Buffer &buffer = OwnBuffer();
+    std::scoped_lock<std::mutex> scopedLock(buffer.mutex);
+    FlushLocked(buffer);
+  }
+
+  // Flushes every buffer, so that the walk sees every element added so far,
+  // and walks the set in its own parts
+  [[nodiscard]] size_t NumParts() final {
+    Flush();
+    return HashSetBase<T>::NumPartsOf(inner_);
+  }
+
+  void CopyPart(size_t part, size_t num_parts, std::vector<T> *out) final {
+    HashSetBase<T>::CopyPartOf(inner_, part, num_parts, out);
+  }
+};
+
+#endif // HASH_SET_BUFFERED_H
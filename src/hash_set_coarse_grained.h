@@ -1,94 +1,235 @@
 #ifndef HASH_SET_COARSE_GRAINED_H
 #define HASH_SET_COARSE_GRAINED_H
 
+#include <atomic>
 #include <cassert>
+#include <functional>
 #include <mutex>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "src/batching.h"
+#include "src/chained_table.h"
 #include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/locking.h"
+#include "src/resizing.h"
+#include "src/stats.h"
+
+// |Table| is the bucket storage engine: ChainedTable, OpenAddressingTable or
+// SwissTable, instantiated with the set's |Hash| and |KeyEqual|. |Lock| is the
+// lock policy, see src/locking.h; with a reader-writer lock such as
+// std::shared_mutex, lookups hold it in shared mode. The table grows and
+// shrinks within the load factors of |policy|, see src/resizing.h
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Table = ChainedTable<T, Hash, KeyEqual>,
+          typename Lock = stats::Mutex>
+class HashSetCoarseGrained : public HashSetBase<T> {
+  static_assert(std::is_same<typename Table::hasher, Hash>::value &&
+                    std::is_same<typename Table::key_equal, KeyEqual>::value,
+                "Table must hash and compare elements as the set does");
 
-template <typename T> class HashSetCoarseGrained : public HashSetBase<T> {
 public:
-  explicit HashSetCoarseGrained(size_t initial_capacity) {
-    table_ = std::vector<std::vector<T>>(initial_capacity);
+  explicit HashSetCoarseGrained(size_t initial_capacity,
+                                resizing::LoadFactorPolicy policy = {4, 0.5})
+      : table_(initial_capacity), policy_(policy.For(Table::kMaxLoad)) {
     set_size_ = 0;
+    min_capacity_ = table_.Capacity();
+    table_.AttachProbes(&probes_);
   }
 
   // Finds the bucket corresponding to the elems hash and inserts the element to
   // that bucket
   bool Add(T elem) final {
-    std::scoped_lock<std::mutex> lock(mutex_);
-    std::vector<T> &bucket = GetBucket(elem);
-    if (VectorContains(bucket, elem)) {
+    std::scoped_lock<Lock> lock(mutex_);
+    size_t elem_hash = Hash()(elem);
+    if (!table_.Insert(elem_hash, std::move(elem))) {
       return false;
-    } else {
-      bucket.push_back(elem);
-      set_size_++;
-      if (Policy()) {
-        Resize();
-      }
-      return true;
     }
+    set_size_++;
+    if (Policy(elem_hash)) {
+      Resize();
+    }
+    return true;
   }
 
   // Finds the bucket corresponding to the elems hash and removes the element
   // from that bucket
-  bool Remove(T elem) final {
-    std::scoped_lock<std::mutex> lock(mutex_);
-    std::vector<T> &bucket = GetBucket(elem);
-    for (auto it = bucket.begin(); it != bucket.end(); it++) {
-      if (*it == elem) {
-        bucket.erase(it);
-        set_size_--;
-        return true;
-      }
+  bool Remove(const T &elem) final {
+    std::scoped_lock<Lock> lock(mutex_);
+    if (!table_.Erase(Hash()(elem), elem)) {
+      return false;
     }
-    return false;
+    set_size_--;
+    ShrinkIfUnderloaded();
+    return true;
   }
 
   // Returns true if the element is contained in the HashSet and false otherwise
-  [[nodiscard]] bool Contains(T elem) final {
-    std::scoped_lock<std::mutex> lock(mutex_);
-    std::vector<T> &bucket = GetBucket(elem);
-    return VectorContains(bucket, elem);
+  [[nodiscard]] bool Contains(const T &elem) final {
+    locking::ReadGuard<Lock> lock(mutex_);
+    return table_.Contains(Hash()(elem), elem);
+  }
+
+  // Looks up |key| without converting it to T, given a transparent Hash and
+  // KeyEqual such as hashing::StringHash and std::equal_to<>
+  template <typename K, typename = std::enable_if_t<
+                            hashing::IsTransparent<Hash, KeyEqual, K>::value>>
+  [[nodiscard]] bool Contains(const K &key) {
+    size_t key_hash = Hash()(key);
+    locking::ReadGuard<Lock> lock(mutex_);
+    return table_.Contains(key_hash, key);
   }
 
   // Returns the total amount of elements in hashset
   [[nodiscard]] size_t Size() const final { return set_size_; }
 
-private:
-  size_t set_size_;
-  std::vector<std::vector<T>> table_;
-  std::mutex mutex_;
-
-  // Helper to Contains returning true iff an element is contained in a bucket
-  bool VectorContains(std::vector<T> &v, const T &elem) {
-    for (auto it = v.begin(); it != v.end(); it++) {
-      if (*it == elem) {
-        return true;
+  // Reads the size under the lock
+  [[nodiscard]] size_t SizeExact() final {
+    locking::ReadGuard<Lock> lock(mutex_);
+    return set_size_;
+  }
+
+  // Grows the table to hold |capacity| elements within the maximum load
+  void Reserve(size_t capacity) final {
+    std::scoped_lock<Lock> lock(mutex_);
+    capacity = policy_.CapacityFor(capacity, min_capacity_);
+    if (capacity > table_.Capacity()) {
+      Rehash(capacity);
+    }
+  }
+
+  // Shrinks the table to the smallest capacity holding the elements within
+  // the maximum load
+  void ShrinkToFit() final {
+    std::scoped_lock<Lock> lock(mutex_);
+    size_t capacity = policy_.CapacityFor(set_size_, min_capacity_);
+    if (hashing::RoundUpToPowerOfTwo(capacity) < table_.Capacity()) {
+      Rehash(capacity);
+    }
+  }
+
+  // Returns the counts of the lock, the probe lengths and the resizes. Empty
+  // unless built with HASH_SET_STATS
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    if constexpr (stats::kEnabled) {
+      snapshot.locks.push_back(stats::CountsOf(mutex_));
+      probes_.CopyTo(&snapshot);
+      resizes_.CopyTo(&snapshot);
+    }
+    return snapshot;
+  }
+
+  // Hashes every element before taking the lock, then inserts them all under a
+  // single acquisition, prefetching buckets ahead of the insertions
+  size_t AddAll(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    std::scoped_lock<Lock> lock(mutex_);
+    size_t added = 0;
+    for (size_t i = 0; i < elems.size(); i++) {
+      PrefetchAhead(hashes, i);
+      if (table_.Insert(hashes[i], elems[i])) {
+        added++;
+        set_size_++;
+        if (Policy(hashes[i])) {
+          Resize();
+        }
+      }
+    }
+    return added;
+  }
+
+  // Removes every element under a single lock acquisition
+  size_t RemoveAll(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    std::scoped_lock<Lock> lock(mutex_);
+    size_t removed = 0;
+    for (size_t i = 0; i < elems.size(); i++) {
+      PrefetchAhead(hashes, i);
+      if (table_.Erase(hashes[i], elems[i])) {
+        removed++;
       }
     }
-    return false;
+    set_size_ -= removed;
+    ShrinkIfUnderloaded();
+    return removed;
+  }
+
+  // Looks every element up under a single lock acquisition
+  [[nodiscard]] std::vector<bool>
+  ContainsMany(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    std::vector<bool> result(elems.size());
+    locking::ReadGuard<Lock> lock(mutex_);
+    for (size_t i = 0; i < elems.size(); i++) {
+      PrefetchAhead(hashes, i);
+      result[i] = table_.Contains(hashes[i], elems[i]);
+    }
+    return result;
+  }
+
+private:
+  // Only written under |mutex_|, but read without it by Size()
+  std::atomic<size_t> set_size_;
+  Table table_;
+  resizing::LoadFactorPolicy policy_;
+  // The table never shrinks below its initial capacity
+  size_t min_capacity_;
+  Lock mutex_;
+  stats::ProbeHistogram probes_;
+  stats::ResizeCounters resizes_;
+
+  // Prefetches the bucket of the element batching::kPrefetchDistance after |i|
+  void PrefetchAhead(const std::vector<size_t> &hashes, size_t i) const {
+    if (i + batching::kPrefetchDistance < hashes.size()) {
+      table_.Prefetch(hashes[i + batching::kPrefetchDistance]);
+    }
   }
 
-  // Helper to return corresponding bucket for elem based on it's hash
-  std::vector<T> &GetBucket(T elem) {
-    return table_[std::hash<T>()(elem) % table_.size()];
+  // Returns true iff the load exceeds the maximum of the policy, or the
+  // storage cannot take another element with this hash
+  bool Policy(size_t hash) {
+    return policy_.ShouldGrow(set_size_, table_.Capacity()) ||
+           table_.Full(hash);
   }
 
-  // Returns true iff the average bucket is holding more than 4 items
-  bool Policy() { return set_size_ / table_.size() > 4; }
+  // Shrinks the table if the load fell below the minimum of the policy. Must
+  // hold the lock
+  void ShrinkIfUnderloaded() {
+    size_t size = set_size_;
+    if (policy_.ShouldShrink(size, table_.Capacity(), min_capacity_)) {
+      Rehash(policy_.ShrunkCapacity(size, table_.Capacity(), min_capacity_));
+    }
+  }
 
   // Creates a new table twice the size of the old table and reinserts all the
-  // old elements
+  // old elements. Called with the lock held, so all of it is exclusive
   void Resize() {
-    std::vector<std::vector<T>> old_table = table_;
-    table_ = std::vector<std::vector<T>>(old_table.size() * 2);
-    for (auto &bucket : old_table) {
-      for (auto &elem : bucket) {
-        GetBucket(elem).push_back(elem);
-      }
-    }
+    stats::ResizeScope resize_scope(&resizes_);
+    resize_scope.Exclusive();
+    table_.Grow();
+  }
+
+  // Rebuilds the table with |capacity|, larger or smaller than the current
+  // one. Called with the lock held
+  void Rehash(size_t capacity) {
+    stats::ResizeScope resize_scope(&resizes_);
+    resize_scope.Exclusive();
+    table_.Rehash(capacity, 1);
+  }
+
+  // There is a single lock, so the set is walked in a single part, copied as
+  // lookups read it
+  [[nodiscard]] size_t NumParts() final { return 1; }
+
+  void CopyPart(size_t /*part*/, size_t /*num_parts*/,
+                std::vector<T> *out) final {
+    locking::ReadGuard<Lock> lock(mutex_);
+    out->reserve(set_size_);
+    table_.ForEach([&](const T &elem) { out->push_back(elem); });
   }
 };
 #endif // HASH_SET_COARSE_GRAINED_H
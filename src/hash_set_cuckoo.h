@@ -0,0 +1,529 @@
+#ifndef HASH_SET_CUCKOO_H
+#define HASH_SET_CUCKOO_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/reclamation.h"
+#include "src/stats.h"
+#include "src/striping.h"
+
+// Concurrent cuckoo hash set in the style of libcuckoo. Every element has two
+// candidate buckets, picked by two hashes, and lives in one of them; buckets
+// hold kSlotsPerBucket elements, so a lookup reads at most two buckets however
+// full the table is, and the table fills above 90% before it has to grow.
+//
+// |Hash| is remixed with hashing::Mix64 before any use, so that keys whose
+// hashes only differ in their high bits, such as multiples of 1024 under the
+// identity std::hash<int>, still spread over every stripe and bucket.
+//
+// Bucket b is guarded by stripe b % num_stripes, and the number of stripes does
+// not depend on the capacity. Both buckets of an element belong to the stripe
+// of its hash, so the table is split into one cuckoo table per stripe and
+// elements never leave their stripe. Writers lock that one stripe. An
+// insertion whose buckets are both full searches, breadth first, for a path of
+// elements that can each move to their other bucket, ending at a free slot,
+// carries the moves out from the free end, and places the element in the slot
+// freed at the start of the path. Only when no short path exists does the
+// table double, under every lock.
+//
+// Elements that share too much of their hash, as a weak |Hash| may let many
+// do, cannot all fit in their two buckets however large the table grows. When
+// no path is found while the stripe is less than kMinGrowLoad full, the
+// element is kept in a small list of the stripe, its stash, instead.
+//
+// Contains does not lock if |T| is trivially copyable. It reads both buckets
+// between two reads of the version counter of their stripe, which writers make
+// odd while they modify it, and retries, falling back to the lock after a few
+// attempts, if it changed; misses also fall back while the stripe has stashed
+// elements. Optimistic readers pin a reclamation::EpochDomain, so that replaced
+// tables are freed once no reader can still be reading them.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>>
+class HashSetCuckoo : public HashSetBase<T> {
+public:
+  // |num_stripes| is rounded up to a power of two
+  explicit HashSetCuckoo(size_t initial_capacity,
+                         size_t num_stripes = striping::DefaultStripeCount())
+      : stripes_(hashing::RoundUpToPowerOfTwo(num_stripes)),
+        stashes_(stripes_.size()) {
+    // Every stripe needs two buckets of its own
+    table_ = new Table(
+        std::max(NumBucketsFor(initial_capacity), 2 * stripes_.size()));
+  }
+
+  HashSetCuckoo(const HashSetCuckoo &) = delete;
+  HashSetCuckoo &operator=(const HashSetCuckoo &) = delete;
+
+  ~HashSetCuckoo() override { delete table_.load(); }
+
+  // Places |elem| in a free slot of one of its buckets, making one by moving
+  // other elements along a cuckoo path if both are full, or by doubling the
+  // table if there is no such path. Stashes |elem| if the stripe is too empty
+  // for doubling to help
+  bool Add(T elem) final {
+    size_t elem_hash = HashOf(elem);
+    while (true) {
+      size_t num_buckets = 0;
+      {
+        Stripe &stripe = GetStripe(elem_hash);
+        std::scoped_lock<stats::Mutex> scopedLock(stripe.mutex);
+        Table &table = *table_.load();
+        num_buckets = table.size();
+        if (Find(table, elem_hash, elem)) {
+          return false;
+        }
+        std::vector<Step> path = FindPath(table, elem_hash);
+        if (!path.empty()) {
+          BeginWrite(stripe);
+          Shift(table, path);
+          Bucket &target = table[path.front().bucket];
+          target.Place(target.FreeSlot(), std::move(elem));
+          EndWrite(stripe);
+          stripe.AddToSize(1);
+          return true;
+        }
+        if (!ShouldGrow(stripe, num_buckets)) {
+          std::vector<T> &stash = stashes_[StripeIndex(elem_hash)];
+          BeginWrite(stripe);
+          stash.push_back(std::move(elem));
+          stripe.stashed.store(stash.size(), std::memory_order_relaxed);
+          EndWrite(stripe);
+          stripe.AddToSize(1);
+          return true;
+        }
+      }
+      // Does nothing if the table was replaced since the search
+      Rebuild([&](size_t current) {
+        return current == num_buckets ? current * 2 : current;
+      });
+    }
+  }
+
+  // Removes |elem| from whichever of its buckets, or its stash, holds it
+  bool Remove(const T &elem) final {
+    size_t elem_hash = HashOf(elem);
+    Stripe &stripe = GetStripe(elem_hash);
+    std::scoped_lock<stats::Mutex> scopedLock(stripe.mutex);
+    Table &table = *table_.load();
+    for (size_t index :
+         {FirstBucket(table, elem_hash), SecondBucket(table, elem_hash)}) {
+      size_t slot = table[index].Find(elem);
+      if (slot != kNotFound) {
+        BeginWrite(stripe);
+        table[index].Clear(slot);
+        EndWrite(stripe);
+        stripe.SubtractFromSize(1);
+        return true;
+      }
+    }
+    std::vector<T> &stash = stashes_[StripeIndex(elem_hash)];
+    for (auto it = stash.begin(); it != stash.end(); it++) {
+      if (KeyEqual()(*it, elem)) {
+        BeginWrite(stripe);
+        stash.erase(it);
+        stripe.stashed.store(stash.size(), std::memory_order_relaxed);
+        EndWrite(stripe);
+        stripe.SubtractFromSize(1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Returns true if the element is contained in the HashSet and false otherwise
+  [[nodiscard]] bool Contains(const T &elem) final {
+    size_t elem_hash = HashOf(elem);
+    if constexpr (kOptimisticReads) {
+      auto guard = epochs_.Pin();
+      bool found = false;
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryContains(elem_hash, elem, &found)) {
+          return found;
+        }
+        if (GetStripe(elem_hash).stashed.load(std::memory_order_relaxed) != 0) {
+          break;
+        }
+      }
+    }
+    std::scoped_lock<stats::Mutex> scopedLock(GetStripe(elem_hash).mutex);
+    return Find(*table_.load(), elem_hash, elem);
+  }
+
+  // Returns total size of HashSet, summing the stripe counts without locking,
+  // so it may be off while other threads are modifying the set
+  [[nodiscard]] size_t Size() const final {
+    size_t size = 0;
+    for (const auto &stripe : stripes_) {
+      size += stripe.size.load(std::memory_order_relaxed);
+    }
+    return size;
+  }
+
+  // Sums the element counts of the stripes while holding every stripe lock
+  [[nodiscard]] size_t SizeExact() final {
+    auto locks = LockAll();
+    return Size();
+  }
+
+  // Grows the table to hold |capacity| elements at the maximum load
+  void Reserve(size_t capacity) final {
+    size_t num_buckets = NumBucketsFor(capacity);
+    Rebuild([&](size_t current) { return std::max(current, num_buckets); });
+  }
+
+  // Returns the resizes. Empty unless built with HASH_SET_STATS
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    if constexpr (stats::kEnabled) {
+      resizes_.CopyTo(&snapshot);
+    }
+    return snapshot;
+  }
+
+private:
+  // Slots per bucket, which keeps a bucket of small elements within a cache
+  // line
+  static constexpr size_t kSlotsPerBucket = 4;
+  // Load at which Reserve sizes the table. Insertions keep filling it past
+  // that until no cuckoo path is found
+  static constexpr double kMaxLoad = 0.9;
+  // Load of a stripe below which an element that found no cuckoo path is
+  // stashed rather than the table doubled. Random hashes only run out of
+  // paths far above it, so below it the elements of the stripe share too much
+  // of their hashes for a larger table to help
+  static constexpr double kMinGrowLoad = 0.5;
+  // Buckets a cuckoo path search visits before the table is deemed full
+  static constexpr size_t kMaxSearch = 512;
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+  // Reading without the lock is only safe if an element can be compared while
+  // it is overwritten
+  static constexpr bool kOptimisticReads = std::is_trivially_copyable<T>::value;
+  // Optimistic reads tried before Contains falls back to taking the lock
+  static constexpr size_t kOptimisticAttempts = 4;
+
+  struct Bucket {
+    std::array<T, kSlotsPerBucket> slots;
+    // Bit i is set iff slots[i] holds an element
+    uint8_t occupied = 0;
+
+    size_t Find(const T &elem) const {
+      for (size_t i = 0; i < kSlotsPerBucket; i++) {
+        if (Occupied(i) && KeyEqual()(slots[i], elem)) {
+          return i;
+        }
+      }
+      return kNotFound;
+    }
+
+    size_t FreeSlot() const {
+      for (size_t i = 0; i < kSlotsPerBucket; i++) {
+        if (!Occupied(i)) {
+          return i;
+        }
+      }
+      return kNotFound;
+    }
+
+    bool Occupied(size_t slot) const { return (occupied >> slot & 1) != 0; }
+
+    template <typename U> void Place(size_t slot, U &&elem) {
+      slots[slot] = std::forward<U>(elem);
+      occupied = static_cast<uint8_t>(occupied | 1U << slot);
+    }
+
+    void Clear(size_t slot) {
+      occupied = static_cast<uint8_t>(occupied & ~(1U << slot));
+    }
+  };
+
+  using Table = std::vector<Bucket>;
+
+  // A stripe that also counts the elements of its stash, which optimistic
+  // readers check for, so that a stash only slows down misses on its stripe
+  struct Stripe : striping::Stripe<> {
+    // Only written under |mutex| and between BeginWrite and EndWrite
+    std::atomic<size_t> stashed{0};
+  };
+
+  // A bucket on a cuckoo path, and the slot whose element moves on to the
+  // bucket of the next step. The slot of the last step is unused
+  struct Step {
+    size_t bucket;
+    size_t slot;
+  };
+
+  // Current table, owned by the set. Replaced tables are retired to
+  // |epochs_|, as optimistic readers may still be reading them
+  std::atomic<Table *> table_;
+  reclamation::EpochDomain epochs_;
+  // Lock, version counter and element count of every stripe. Elements are
+  // counted in the stripe of their hash, which holds both of their buckets
+  std::vector<Stripe> stripes_;
+  // Stash of every stripe, guarded by the stripe lock
+  std::vector<std::vector<T>> stashes_;
+  stats::ResizeCounters resizes_;
+
+  // Returns the power of two number of buckets that holds |capacity|
+  // elements at the maximum load
+  static size_t NumBucketsFor(size_t capacity) {
+    auto slots = static_cast<size_t>(static_cast<double>(capacity) / kMaxLoad);
+    return hashing::RoundUpToPowerOfTwo(
+        std::max<size_t>(slots / kSlotsPerBucket + 1, 2));
+  }
+
+  // Returns the remixed hash of |elem|, which every other function takes
+  static size_t HashOf(const T &elem) {
+    return static_cast<size_t>(hashing::Mix64(Hash()(elem)));
+  }
+
+  size_t StripeIndex(size_t hash) const {
+    return hash & (stripes_.size() - 1);
+  }
+
+  Stripe &GetStripe(size_t hash) {
+    return stripes_[StripeIndex(hash)];
+  }
+
+  static size_t FirstBucket(const Table &table, size_t hash) {
+    return hash & (table.size() - 1);
+  }
+
+  // The second bucket comes from the hash mixed once more, with the stripe bits
+  // of the first bucket, and is moved off the first bucket if both coincide
+  size_t SecondBucket(const Table &table, size_t hash) const {
+    size_t first = FirstBucket(table, hash);
+    size_t stripe_mask = stripes_.size() - 1;
+    size_t second = (static_cast<size_t>(hashing::Mix64(hash)) &
+                     (table.size() - 1) & ~stripe_mask) |
+                    (first & stripe_mask);
+    return second == first ? first ^ stripes_.size() : second;
+  }
+
+  // Returns the bucket other than |index| that the element of |hash| may live
+  // in
+  size_t OtherBucket(const Table &table, size_t hash, size_t index) const {
+    size_t first = FirstBucket(table, hash);
+    return index == first ? SecondBucket(table, hash) : first;
+  }
+
+  // Returns true iff |elem| is in its buckets of |table| or in its stash.
+  // Must hold the lock of its stripe
+  bool Find(const Table &table, size_t hash, const T &elem) const {
+    if (table[FirstBucket(table, hash)].Find(elem) != kNotFound ||
+        table[SecondBucket(table, hash)].Find(elem) != kNotFound) {
+      return true;
+    }
+    const std::vector<T> &stash = stashes_[StripeIndex(hash)];
+    return std::any_of(stash.begin(), stash.end(), [&](const T &stashed) {
+      return KeyEqual()(stashed, elem);
+    });
+  }
+
+  // The stripe, with |num_buckets| buckets in the table, is at least
+  // kMinGrowLoad full. Must hold its lock
+  bool ShouldGrow(const Stripe &stripe, size_t num_buckets) const {
+    size_t slots = num_buckets / stripes_.size() * kSlotsPerBucket;
+    return static_cast<double>(stripe.size.load(std::memory_order_relaxed)) >=
+           kMinGrowLoad * static_cast<double>(slots);
+  }
+
+  // Takes every stripe lock, in order, until the returned locks are destroyed
+  std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> LockAll() {
+    std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> locks;
+    for (auto &stripe : stripes_) {
+      locks.push_back(
+          std::make_unique<std::scoped_lock<stats::Mutex>>(stripe.mutex));
+    }
+    return locks;
+  }
+
+  // Marks |stripe| as being modified. Must hold its lock
+  static void BeginWrite(Stripe &stripe) {
+    if constexpr (kOptimisticReads) {
+      stripe.version.store(stripe.version.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  }
+
+  // Publishes the modification of |stripe|. Must hold its lock
+  static void EndWrite(Stripe &stripe) {
+    if constexpr (kOptimisticReads) {
+      stripe.version.store(stripe.version.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+    }
+  }
+
+  // Looks for |elem| in both of its buckets without locking and stores the
+  // outcome in |found|. Returns false if a writer was inside the stripe at any
+  // point, or the table was replaced, in which case |found| must be
+  // discarded, and also on a miss while the stripe has stashed elements, as
+  // only the lock gives access to the stash. The caller must pin |epochs_|
+  bool TryContains(size_t hash, const T &elem, bool *found) {
+    Stripe &stripe = GetStripe(hash);
+    std::atomic<size_t> &version = stripe.version;
+    size_t before = version.load(std::memory_order_acquire);
+    if ((before & 1) != 0) {
+      return false;
+    }
+    const Table *table = table_.load(std::memory_order_acquire);
+    *found = (*table)[FirstBucket(*table, hash)].Find(elem) != kNotFound ||
+             (*table)[SecondBucket(*table, hash)].Find(elem) != kNotFound;
+    // Writers only change the stash between BeginWrite and EndWrite, so the
+    // count agrees with the buckets read if the validation passes
+    bool stashed = stripe.stashed.load(std::memory_order_relaxed) != 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == before &&
+           table == table_.load(std::memory_order_relaxed) &&
+           (*found || !stashed);
+  }
+
+  // Searches breadth first, from both buckets of |hash|, for a bucket with a
+  // free slot that the elements along the way can be moved towards. Returns
+  // the steps from a bucket of |hash| to the free one, or nothing if none is
+  // found within kMaxSearch buckets. Every bucket visited belongs to the
+  // stripe of |hash|, whose lock the caller must hold unless it owns |table|
+  std::vector<Step> FindPath(const Table &table, size_t hash) const {
+    struct Node {
+      size_t bucket;
+      // Index of the node this one was reached from, and the slot of the
+      // element there that would move to |bucket|
+      size_t parent;
+      size_t slot;
+    };
+    std::vector<Node> nodes = {
+        {FirstBucket(table, hash), kNotFound, 0},
+        {SecondBucket(table, hash), kNotFound, 0},
+    };
+    for (size_t next = 0; next < nodes.size() && next < kMaxSearch; next++) {
+      size_t index = nodes[next].bucket;
+      const Bucket &bucket = table[index];
+      if (bucket.FreeSlot() != kNotFound) {
+        std::vector<Step> path;
+        size_t slot = 0;
+        for (size_t node = next; node != kNotFound;
+             node = nodes[node].parent) {
+          path.push_back({nodes[node].bucket, slot});
+          slot = nodes[node].slot;
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+      }
+      for (size_t slot = 0; slot < kSlotsPerBucket; slot++) {
+        nodes.push_back(
+            {OtherBucket(table, HashOf(bucket.slots[slot]), index), next,
+             slot});
+      }
+    }
+    return {};
+  }
+
+  // Carries out the moves of |path| from its free end, so that the first
+  // bucket of the path ends up with a free slot and no element is ever out of
+  // its buckets. Same locking as FindPath
+  static void Shift(Table &table, const std::vector<Step> &path) {
+    for (size_t i = path.size() - 1; i > 0; i--) {
+      Bucket &source = table[path[i - 1].bucket];
+      Bucket &target = table[path[i].bucket];
+      size_t slot = path[i - 1].slot;
+      target.Place(target.FreeSlot(), std::move(source.slots[slot]));
+      source.Clear(slot);
+    }
+  }
+
+  // Places |elem| in |to|, which the caller owns, or appends it to |stashes|
+  // if it finds no cuckoo path
+  void Place(const T &elem, Table *to,
+             std::vector<std::vector<T>> *stashes) const {
+    size_t hash = HashOf(elem);
+    std::vector<Step> path = FindPath(*to, hash);
+    if (path.empty()) {
+      (*stashes)[StripeIndex(hash)].push_back(elem);
+      return;
+    }
+    Shift(*to, path);
+    Bucket &target = (*to)[path.front().bucket];
+    target.Place(target.FreeSlot(), elem);
+  }
+
+  // Rebuilds the table with the number of buckets |target| picks given the
+  // current one, or leaves it as is if |target| returns the current number.
+  // Stashed elements are placed in the new table too, and whatever finds no
+  // room there is stashed. Locks every stripe, which ensures the set is not
+  // modified meanwhile, so no locks may be held by the caller. Optimistic
+  // readers keep reading the old table until the new one is complete. The
+  // old table is then retired, and freed here unless a reader is still pinned
+  template <typename Target> void Rebuild(Target target) {
+    stats::ResizeScope resize_scope(&resizes_);
+    auto locks = LockAll();
+    resize_scope.Exclusive();
+
+    Table *table = table_.load();
+    size_t num_buckets = target(table->size());
+    if (num_buckets == table->size()) {
+      return;
+    }
+    // Copied rather than moved, as optimistic readers may still be comparing
+    // the elements of the old table
+    auto rebuilt = std::make_unique<Table>(num_buckets);
+    std::vector<std::vector<T>> stashes(stripes_.size());
+    for (const Bucket &bucket : *table) {
+      for (size_t slot = 0; slot < kSlotsPerBucket; slot++) {
+        if (bucket.Occupied(slot)) {
+          Place(bucket.slots[slot], rebuilt.get(), &stashes);
+        }
+      }
+    }
+    for (const auto &stash : stashes_) {
+      for (const T &elem : stash) {
+        Place(elem, rebuilt.get(), &stashes);
+      }
+    }
+    for (auto &stripe : stripes_) {
+      BeginWrite(stripe);
+    }
+    table_ = rebuilt.release();
+    stashes_ = std::move(stashes);
+    for (size_t i = 0; i < stripes_.size(); i++) {
+      stripes_[i].stashed.store(stashes_[i].size(), std::memory_order_relaxed);
+    }
+    for (auto &stripe : stripes_) {
+      EndWrite(stripe);
+    }
+    epochs_.Retire(table);
+    locks.clear();
+    epochs_.Collect();
+  }
+
+  // The set is walked a stripe at a time, as elements never leave theirs
+  [[nodiscard]] size_t NumParts() final { return stripes_.size(); }
+
+  // Copies the buckets and the stash of stripe |part| under its lock
+  void CopyPart(size_t part, size_t /*num_parts*/, std::vector<T> *out) final {
+    std::scoped_lock<stats::Mutex> scopedLock(stripes_[part].mutex);
+    const Table &table = *table_.load();
+    for (size_t index = part; index < table.size(); index += stripes_.size()) {
+      const Bucket &bucket = table[index];
+      for (size_t slot = 0; slot < kSlotsPerBucket; slot++) {
+        if (bucket.Occupied(slot)) {
+          out->push_back(bucket.slots[slot]);
+        }
+      }
+    }
+    out->insert(out->end(), stashes_[part].begin(), stashes_[part].end());
+  }
+};
+
+#endif // HASH_SET_CUCKOO_H
@@ -0,0 +1,345 @@
+#ifndef HASH_SET_LOCK_FREE_H
+#define HASH_SET_LOCK_FREE_H
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/reclamation.h"
+#include "src/sharded_counter.h"
+
+// Lock-free hash set implemented as a split-ordered list (Shalev and Shavit).
+// Every element lives in one lock-free linked list sorted by the bit-reversed
+// hash of the element. Buckets are shortcuts into that list, each starting at a
+// sentinel node, so doubling the number of buckets never moves an element: a
+// new bucket is initialised the first time it is used by splicing its sentinel
+// into the list after its parent bucket. Every operation pins a
+// reclamation::EpochDomain while it walks the list, and unlinked nodes are
+// retired to it, so they are freed once no traversal can still reach them.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>>
+class HashSetLockFree : public HashSetBase<T> {
+public:
+  explicit HashSetLockFree(size_t initial_capacity) {
+    bucket_count_ = hashing::RoundUpToPowerOfTwo(initial_capacity);
+    for (auto &segment : segments_) {
+      segment = nullptr;
+    }
+    GetSlot(0).store(new Node(0, T(), true));
+  }
+
+  HashSetLockFree(const HashSetLockFree &) = delete;
+  HashSetLockFree &operator=(const HashSetLockFree &) = delete;
+
+  // Frees the nodes still in the list; |epochs_| frees the retired ones
+  ~HashSetLockFree() override {
+    Node *node = GetSlot(0).load();
+    while (node != nullptr) {
+      Node *next = Ptr(node->next.load());
+      delete node;
+      node = next;
+    }
+    for (auto &segment : segments_) {
+      delete[] segment.load();
+    }
+  }
+
+  // Links a new node holding |elem| into the list after the bucket sentinel,
+  // and doubles the bucket count if the average bucket got too long. The size
+  // is only summed every kSizeCheckInterval insertions counted by a cell
+  bool Add(T elem) final {
+    size_t elem_hash = Hash()(elem);
+    auto guard = epochs_.Pin();
+    bool inserted = false;
+    Insert(GetBucket(elem_hash), RegularKey(elem_hash), std::move(elem), false,
+           &inserted);
+    if (!inserted) {
+      return false;
+    }
+    if (set_size_.Increment() % kSizeCheckInterval == 0) {
+      size_t bucket_count = bucket_count_.load();
+      if (set_size_.Sum() / bucket_count > 4) {
+        // Losing this race is fine, someone else already grew the table
+        bucket_count_.compare_exchange_strong(bucket_count, bucket_count * 2);
+      }
+    }
+    return true;
+  }
+
+  // Logically deletes the node holding |elem| by marking its next pointer,
+  // then tries to unlink it physically
+  bool Remove(const T &elem) final {
+    size_t elem_hash = Hash()(elem);
+    auto guard = epochs_.Pin();
+    Node *head = GetBucket(elem_hash);
+    uint64_t key = RegularKey(elem_hash);
+    while (true) {
+      Window window = Find(head, key, elem, false);
+      if (!Matches(window.curr, key, elem, false)) {
+        return false;
+      }
+      uintptr_t succ = window.curr->next.load();
+      if (IsMarked(succ)) {
+        continue;
+      }
+      if (!window.curr->next.compare_exchange_strong(succ,
+                                                     Pack(Ptr(succ), true))) {
+        continue;
+      }
+      set_size_.Decrement();
+      uintptr_t expected = Pack(window.curr, false);
+      if (window.pred->next.compare_exchange_strong(expected,
+                                                    Pack(Ptr(succ), false))) {
+        epochs_.Retire(window.curr);
+      } else {
+        // Someone changed pred, so let Find unlink the marked node
+        (void)Find(head, key, elem, false);
+      }
+      return true;
+    }
+  }
+
+  // Returns true if the element is contained in the HashSet and false otherwise
+  [[nodiscard]] bool Contains(const T &elem) final {
+    size_t elem_hash = Hash()(elem);
+    uint64_t key = RegularKey(elem_hash);
+    auto guard = epochs_.Pin();
+    Window window = Find(GetBucket(elem_hash), key, elem, false);
+    return Matches(window.curr, key, elem, false);
+  }
+
+  // Returns total size of HashSet, which may miss concurrent updates. There is
+  // no exact alternative, as nothing can pause the writers
+  [[nodiscard]] size_t Size() const final { return set_size_.Sum(); }
+
+  // Raises the bucket count so that |capacity| elements average at most 4 per
+  // bucket. New buckets are initialised on first use, as after a doubling.
+  // There is no ShrinkToFit, as sentinels are never taken out of the list
+  void Reserve(size_t capacity) final {
+    size_t target = hashing::RoundUpToPowerOfTwo((capacity + 3) / 4);
+    size_t bucket_count = bucket_count_.load();
+    while (bucket_count < target &&
+           !bucket_count_.compare_exchange_weak(bucket_count, target)) {
+    }
+  }
+
+private:
+  // The set is walked a bucket at a time, in list order
+  [[nodiscard]] size_t NumParts() final { return bucket_count_.load(); }
+
+  // Copies the live elements between the sentinel of the |part|-th bucket in
+  // list order and the next sentinel of a |num_parts| bucket table. Buckets
+  // added since only split that range, as their sentinels land inside it
+  void CopyPart(size_t part, size_t num_parts, std::vector<T> *out) final {
+    size_t shift = 64 - hashing::Log2(num_parts);
+    auto guard = epochs_.Pin();
+    Node *node = GetSlot(0).load();
+    if (num_parts > 1) {
+      uint64_t first_key = static_cast<uint64_t>(part) << shift;
+      size_t bucket = Reverse(first_key);
+      node = GetSlot(bucket).load();
+      if (node == nullptr) {
+        node = InitializeBucket(bucket);
+      }
+    }
+    while (node != nullptr &&
+           (num_parts == 1 || (node->key >> shift) == part)) {
+      uintptr_t next = node->next.load();
+      if (!node->sentinel && !IsMarked(next)) {
+        out->push_back(node->elem);
+      }
+      node = Ptr(next);
+    }
+  }
+
+  struct Node {
+    Node(uint64_t node_key, T node_elem, bool is_sentinel)
+        : key(node_key), elem(std::move(node_elem)), sentinel(is_sentinel) {
+      next = 0;
+    }
+
+    // Bit-reversed hash; even for sentinels, odd for regular nodes
+    uint64_t key;
+    T elem;
+    bool sentinel;
+    // Successor pointer, with the lowest bit marking this node as deleted
+    std::atomic<uintptr_t> next;
+  };
+
+  struct Window {
+    Node *pred;
+    Node *curr;
+  };
+
+  // Buckets are stored in segments of doubling size so that the bucket array
+  // can grow without being copied: segment s holds 2^s buckets
+  static constexpr size_t kNumSegments = 64;
+  // Insertions counted by one cell of |set_size_| between two checks of the
+  // load factor
+  static constexpr size_t kSizeCheckInterval = 32;
+
+  ShardedCounter set_size_;
+  std::atomic<size_t> bucket_count_;
+  std::array<std::atomic<std::atomic<Node *> *>, kNumSegments> segments_;
+  // Unlinked nodes wait there until no traversal can still be reading them
+  reclamation::EpochDomain epochs_;
+
+  static Node *Ptr(uintptr_t word) {
+    return reinterpret_cast<Node *>(word & ~static_cast<uintptr_t>(1));
+  }
+
+  static bool IsMarked(uintptr_t word) { return (word & 1) != 0; }
+
+  static uintptr_t Pack(Node *node, bool marked) {
+    return reinterpret_cast<uintptr_t>(node) | (marked ? 1 : 0);
+  }
+
+  static uint64_t Reverse(uint64_t value) {
+    value = ((value >> 1) & 0x5555555555555555ULL) |
+            ((value & 0x5555555555555555ULL) << 1);
+    value = ((value >> 2) & 0x3333333333333333ULL) |
+            ((value & 0x3333333333333333ULL) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) |
+            ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    value = ((value >> 8) & 0x00FF00FF00FF00FFULL) |
+            ((value & 0x00FF00FF00FF00FFULL) << 8);
+    value = ((value >> 16) & 0x0000FFFF0000FFFFULL) |
+            ((value & 0x0000FFFF0000FFFFULL) << 16);
+    return (value >> 32) | (value << 32);
+  }
+
+  static uint64_t RegularKey(size_t hash) {
+    return Reverse(static_cast<uint64_t>(hash)) | 1;
+  }
+
+  static uint64_t SentinelKey(size_t bucket) {
+    return Reverse(static_cast<uint64_t>(bucket));
+  }
+
+  // Index of the highest set bit of a non-zero value
+  static size_t HighestBit(uint64_t value) {
+    return static_cast<size_t>(63 - __builtin_clzll(value));
+  }
+
+  // Returns true iff |node| is the node holding |elem| (or the sentinel with
+  // |key| when |sentinel| is set)
+  static bool Matches(const Node *node, uint64_t key, const T &elem,
+                      bool sentinel) {
+    return node != nullptr && node->key == key && node->sentinel == sentinel &&
+           (sentinel || KeyEqual()(node->elem, elem));
+  }
+
+  // Returns the slot holding the sentinel of |bucket|, allocating its segment
+  // on first use
+  std::atomic<Node *> &GetSlot(size_t bucket) {
+    size_t index = bucket + 1;
+    size_t segment_index = HighestBit(index);
+    std::atomic<Node *> *segment = segments_[segment_index].load();
+    if (segment == nullptr) {
+      size_t segment_size = size_t{1} << segment_index;
+      auto *fresh = new std::atomic<Node *>[segment_size];
+      for (size_t i = 0; i < segment_size; i++) {
+        fresh[i] = nullptr;
+      }
+      if (segments_[segment_index].compare_exchange_strong(segment, fresh)) {
+        segment = fresh;
+      } else {
+        delete[] fresh;
+      }
+    }
+    return segment[index - (size_t{1} << segment_index)];
+  }
+
+  // Returns the sentinel of the bucket corresponding to |hash|
+  Node *GetBucket(size_t hash) {
+    size_t bucket = hash & (bucket_count_.load() - 1);
+    Node *sentinel = GetSlot(bucket).load();
+    if (sentinel == nullptr) {
+      sentinel = InitializeBucket(bucket);
+    }
+    return sentinel;
+  }
+
+  // Splices the sentinel of |bucket| into the list, initialising the parent
+  // bucket first if necessary. The parent is |bucket| without its top bit
+  Node *InitializeBucket(size_t bucket) {
+    size_t parent = bucket - (size_t{1} << HighestBit(bucket));
+    Node *parent_sentinel = GetSlot(parent).load();
+    if (parent_sentinel == nullptr) {
+      parent_sentinel = InitializeBucket(parent);
+    }
+    bool inserted = false;
+    Node *sentinel =
+        Insert(parent_sentinel, SentinelKey(bucket), T(), true, &inserted);
+    GetSlot(bucket).store(sentinel);
+    return sentinel;
+  }
+
+  // Returns the window (pred, curr) such that curr is the first node at or
+  // after the matching node for |key| and |elem|, unlinking marked nodes on the
+  // way. The caller must pin |epochs_|
+  Window Find(Node *head, uint64_t key, const T &elem, bool sentinel) {
+    while (true) {
+      Node *pred = head;
+      Node *curr = Ptr(pred->next.load());
+      bool restart = false;
+      while (curr != nullptr) {
+        uintptr_t succ = curr->next.load();
+        if (IsMarked(succ)) {
+          uintptr_t expected = Pack(curr, false);
+          if (!pred->next.compare_exchange_strong(expected,
+                                                  Pack(Ptr(succ), false))) {
+            restart = true;
+            break;
+          }
+          epochs_.Retire(curr);
+          curr = Ptr(succ);
+          continue;
+        }
+        if (curr->key > key || Matches(curr, key, elem, sentinel)) {
+          break;
+        }
+        pred = curr;
+        curr = Ptr(succ);
+      }
+      if (!restart) {
+        return {pred, curr};
+      }
+    }
+  }
+
+  // Inserts a node for |key| and |elem| into the list starting at |head|,
+  // moving |elem| into it. Returns the node that ends up in the list, and sets
+  // |inserted| to false if that node was already there
+  Node *Insert(Node *head, uint64_t key, T &&elem, bool sentinel,
+               bool *inserted) {
+    Node *node = nullptr;
+    while (true) {
+      // Once the node is allocated, it holds the element
+      const T &target = node == nullptr ? elem : node->elem;
+      Window window = Find(head, key, target, sentinel);
+      if (Matches(window.curr, key, target, sentinel)) {
+        delete node;
+        *inserted = false;
+        return window.curr;
+      }
+      if (node == nullptr) {
+        node = new Node(key, std::move(elem), sentinel);
+      }
+      node->next = Pack(window.curr, false);
+      uintptr_t expected = Pack(window.curr, false);
+      if (window.pred->next.compare_exchange_strong(expected,
+                                                    Pack(node, false))) {
+        *inserted = true;
+        return node;
+      }
+    }
+  }
+};
+
+#endif // HASH_SET_LOCK_FREE_H
@@ -2,219 +2,734 @@
 #define HASH_SET_REFINABLE_H
 
 #include <atomic>
-#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-class AtomicMarkableReference {
+// Pointer to a |T| paired with a mark, read and replaced together as one atomic
+// word in the manner of Java's AtomicMarkableReference. The mark lives in the
+// low bit of the pointer, which the alignment of |T| leaves clear
+template <typename T> class AtomicMarkableReference {
+  static_assert(alignof(T) >= 2, "The low bit of a T * must be free");
+  static_assert(std::atomic<uintptr_t>::is_always_lock_free,
+                "The pointer and mark must fit one lock-free word");
+
 public:
-  explicit AtomicMarkableReference(std::thread::id initial_owner,
-                                   bool resizing) {
-    owner = initial_owner;
-    is_resizing = resizing;
-  }
+  AtomicMarkableReference(T *reference, bool mark)
+      : word_(Pack(reference, mark)) {}
 
-  std::thread::id get(bool *resizing) {
-    std::scoped_lock<std::mutex> scopedLock(mutex);
-    *resizing = is_resizing;
-    return owner;
+  // Returns the reference, storing the mark it was paired with in |*mark|
+  T *Get(bool *mark) const {
+    uintptr_t word = word_.load();
+    *mark = (word & 1) != 0;
+    return reinterpret_cast<T *>(word & ~uintptr_t{1});
   }
 
-  bool CompareAndSet(std::thread::id expected_owner, std::thread::id new_owner,
-                     bool expected_bool, bool new_bool) {
-    std::scoped_lock<std::mutex> scopedLock(mutex);
-    if (expected_owner == owner && expected_bool == is_resizing) {
-      owner = new_owner;
-      is_resizing = new_bool;
-      return true;
-    }
-    return false;
+  // Replaces reference and mark with |new_reference| and |new_mark| iff they
+  // are still |expected_reference| and |expected_mark|
+  bool CompareAndSet(T *expected_reference, T *new_reference,
+                     bool expected_mark, bool new_mark) {
+    uintptr_t expected = Pack(expected_reference, expected_mark);
+    return word_.compare_exchange_strong(expected,
+                                         Pack(new_reference, new_mark));
   }
 
+  void Set(T *reference, bool mark) { word_.store(Pack(reference, mark)); }
+
 private:
-  std::thread::id owner;
-  bool is_resizing = false;
-  std::mutex mutex;
+  std::atomic<uintptr_t> word_;
+
+  static uintptr_t Pack(T *reference, bool mark) {
+    return reinterpret_cast<uintptr_t>(reference) |
+           static_cast<uintptr_t>(mark);
+  }
 };
 
+#include "src/batching.h"
+#include "src/chained_table.h"
 #include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/reclamation.h"
+#include "src/resizing.h"
+#include "src/sharded_counter.h"
+#include "src/stats.h"
+#include "src/striping.h"
+
+// Lock-striped hash set whose lock array doubles along with the table, as in
+// Herlihy and Shavit's refinable hash set, so that the number of elements per
+// lock stays bounded however large the set grows. One thread owns each resize:
+// it marks |owner| so that no other thread can take a lock, waits until every
+// lock of the current array has been released, and then installs the grown
+// table together with a lock array twice the size.
+//
+// |Table| is the bucket storage engine: ChainedTable, OpenAddressingTable or
+// SwissTable, instantiated with the set's |Hash| and |KeyEqual|. Its regions
+// double with the locks. As in HashSetStriped, Contains reads optimistically
+// against per-stripe version counters when the engine allows it, and replaced
+// tables are retired to a reclamation::EpochDomain that those readers pin. The
+// table grows and shrinks within the load factors of |policy|, see
+// src/resizing.h; the lock array never shrinks, as it only costs memory
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Table = ChainedTable<T, Hash, KeyEqual>>
+class HashSetRefinable : public HashSetBase<T> {
+  static_assert(std::is_same<typename Table::hasher, Hash>::value &&
+                    std::is_same<typename Table::key_equal, KeyEqual>::value,
+                "Table must hash and compare elements as the set does");
+
+  using Stripes = std::vector<striping::Stripe<>>;
 
-template <typename T> class HashSetRefinable : public HashSetBase<T> {
 public:
-  explicit HashSetRefinable(size_t initial_capacity) {
-    table = std::vector<std::vector<T>>(initial_capacity);
-    owner = new AtomicMarkableReference(std::this_thread::get_id(), false);
-    set_size = 0;
-    for (size_t i = 0; i < initial_capacity; i++) {
-      mutex_ptrs_.push_back(std::make_unique<std::mutex>());
-    }
+  // |num_stripes| is rounded up to a power of two
+  explicit HashSetRefinable(size_t initial_capacity,
+                            size_t num_stripes = striping::DefaultStripeCount(),
+                            resizing::LoadFactorPolicy policy = {1, 0.125})
+      : owner(nullptr, false), policy_(policy.For(Table::kMaxLoad)) {
+    stripe_arrays_.push_back(
+        std::make_unique<Stripes>(hashing::RoundUpToPowerOfTwo(num_stripes)));
+    stripes_ = stripe_arrays_.back().get();
+    table = new Table(initial_capacity, stripes_.load()->size());
+    min_capacity_ = table.load()->Capacity();
+    table.load()->AttachProbes(&probes_);
   }
 
+  HashSetRefinable(const HashSetRefinable &) = delete;
+  HashSetRefinable &operator=(const HashSetRefinable &) = delete;
+
+  ~HashSetRefinable() override { delete table.load(); }
+
   bool Add(T elem) final {
-    size_t elem_hash = std::hash<T>()(elem);
-    std::unique_lock<std::mutex> uniqueLock(*GetLock(elem_hash));
-    std::vector<T> &bucket = GetBucket(elem_hash);
-    if (VectorContains(bucket, elem)) {
+    size_t elem_hash = Hash()(elem);
+    std::unique_lock<stats::Mutex> uniqueLock(Acquire(elem_hash),
+                                              std::adopt_lock);
+    while (table.load()->Full(elem_hash)) {
+      // Other threads filled the region of this element before the table
+      // grew, so make room first
+      size_t capacity = table.load()->Capacity();
+      uniqueLock.unlock();
+      Resize(capacity);
+      uniqueLock =
+          std::unique_lock<stats::Mutex>(Acquire(elem_hash), std::adopt_lock);
+    }
+    BeginWrite(elem_hash);
+    bool inserted = table.load()->Insert(elem_hash, std::move(elem));
+    EndWrite(elem_hash);
+    if (!inserted) {
       return false;
-    } else {
-      bucket.push_back(elem);
-      set_size++;
-      if (Policy()) {
-        // Cannot hold any locks when calling resize as
-        uniqueLock.unlock();
-        Resize();
-      }
-      return true;
     }
+    if (Policy(elem_hash, set_size_.Increment())) {
+      // Cannot hold any locks when calling resize
+      size_t capacity = table.load()->Capacity();
+      uniqueLock.unlock();
+      Resize(capacity);
+    }
+    return true;
   }
 
   // Finds the bucket corresponding to the elems hash and removes the element
   // from that bucket
-  bool Remove(T elem) final {
-    size_t elem_hash = std::hash<T>()(elem);
-    std::scoped_lock<std::mutex> scopedLock(*GetLock(elem_hash));
-    std::vector<T> &bucket = GetBucket(elem_hash);
-    for (auto it = bucket.begin(); it != bucket.end(); it++) {
-      if (*it == elem) {
-        bucket.erase(it);
-        set_size--;
-        return true;
-      }
+  bool Remove(const T &elem) final {
+    size_t elem_hash = Hash()(elem);
+    std::unique_lock<stats::Mutex> uniqueLock(Acquire(elem_hash),
+                                              std::adopt_lock);
+    BeginWrite(elem_hash);
+    bool erased = table.load()->Erase(elem_hash, elem);
+    EndWrite(elem_hash);
+    if (!erased) {
+      return false;
     }
-    return false;
+    if (ShrinkPolicy(set_size_.Decrement())) {
+      uniqueLock.unlock();
+      Shrink();
+    }
+    return true;
   }
 
   // Returns true if the element is contained in the HashSet and false otherwise
-  [[nodiscard]] bool Contains(T elem) final {
-    size_t elem_hash = std::hash<T>()(elem);
-    std::scoped_lock<std::mutex> scopedLock(*GetLock(elem_hash));
-    return VectorContains(GetBucket(elem_hash), elem);
+  [[nodiscard]] bool Contains(const T &elem) final {
+    return ContainsKey(elem);
+  }
+
+  // Looks up |key| without converting it to T, given a transparent Hash and
+  // KeyEqual such as hashing::StringHash and std::equal_to<>
+  template <typename K, typename = std::enable_if_t<
+                            hashing::IsTransparent<Hash, KeyEqual, K>::value>>
+  [[nodiscard]] bool Contains(const K &key) {
+    return ContainsKey(key);
   }
 
-  // Returns total size of HashSet
-  [[nodiscard]] size_t Size() const final { return set_size; }
+  // Returns total size of HashSet, which may miss concurrent updates
+  [[nodiscard]] size_t Size() const final { return set_size_.Sum(); }
 
-private:
-  std::atomic<std::size_t> set_size;
-  std::vector<std::vector<T>> table;
-  AtomicMarkableReference *owner;
-  // List of mutexes corresponding to every initial bucket bucket
-  std::vector<std::unique_ptr<std::mutex>> mutex_ptrs_;
+  // Sums the size counter while holding every lock of the current array
+  [[nodiscard]] size_t SizeExact() final {
+    auto locks = LockAll();
+    return set_size_.Sum();
+  }
 
-  // Helper to Contains returning true iff an element is contained in a bucket
-  bool VectorContains(std::vector<T> &v, const T &elem) {
-    for (auto it = v.begin(); it != v.end(); it++) {
-      if (*it == elem) {
-        return true;
+  // Grows the table to hold |capacity| elements within the maximum load,
+  // waiting for any resize in progress to finish first
+  void Reserve(size_t capacity) final {
+    capacity = policy_.CapacityFor(capacity, min_capacity_);
+    while (!Rebuild([&](size_t current) {
+      return capacity > current ? capacity : current;
+    })) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Shrinks the table to the smallest capacity holding the elements within
+  // the maximum load, waiting for any resize in progress to finish first
+  void ShrinkToFit() final {
+    while (!Rebuild([&](size_t current) {
+      size_t capacity = policy_.CapacityFor(set_size_.Sum(), min_capacity_);
+      return hashing::RoundUpToPowerOfTwo(capacity) < current ? capacity
+                                                              : current;
+    })) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Returns the counts of every lock of the current array, the probe lengths
+  // and the resizes. The counts of replaced lock arrays are folded into the
+  // stripes that took over from them. Safe alongside a resize, which only
+  // adds an array while holding |arrays_mutex_|. Empty unless built with
+  // HASH_SET_STATS
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    if constexpr (stats::kEnabled) {
+      std::scoped_lock<std::mutex> arraysLock(arrays_mutex_);
+      for (const auto &stripes : stripe_arrays_) {
+        stats::Snapshot array;
+        for (const auto &stripe : *stripes) {
+          array.locks.push_back(stats::CountsOf(stripe.mutex));
+        }
+        snapshot.Merge(array);
       }
+      probes_.CopyTo(&snapshot);
+      resizes_.CopyTo(&snapshot);
     }
-    return false;
+    return snapshot;
   }
 
-  // Acquires specific lock for elem
-  void acquire(T elem) {
-    bool mark = true;
-    std::thread::id this_thread = std::this_thread::get_id();
-    std::thread::id current_owner;
+  // Hashes every element up front and groups the elements by stripe, so that
+  // each stripe lock is taken once per batch
+  size_t AddAll(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    size_t num_stripes = stripes_.load()->size();
+    std::vector<size_t> order = batching::GroupByStripe(hashes, num_stripes);
+    size_t added = 0;
+    for (size_t begin = 0; begin < order.size();) {
+      size_t end = batching::GroupEnd(hashes, order, begin, num_stripes);
+      added += AddGroup(elems, hashes, order, begin, end, num_stripes);
+      begin = end;
+    }
+    return added;
+  }
+
+  // Removes the elements stripe by stripe, as AddAll does
+  size_t RemoveAll(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    size_t num_stripes = stripes_.load()->size();
+    std::vector<size_t> order = batching::GroupByStripe(hashes, num_stripes);
+    size_t removed = 0;
+    for (size_t begin = 0; begin < order.size();) {
+      size_t end = batching::GroupEnd(hashes, order, begin, num_stripes);
+      removed += RemoveGroup(elems, hashes, order, begin, end, num_stripes);
+      begin = end;
+    }
+    return removed;
+  }
+
+  // Looks the elements up stripe by stripe, validating a whole stripe's worth
+  // of optimistic reads at once
+  [[nodiscard]] std::vector<bool>
+  ContainsMany(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    size_t num_stripes = stripes_.load()->size();
+    std::vector<size_t> order = batching::GroupByStripe(hashes, num_stripes);
+    std::vector<bool> result(elems.size());
+    for (size_t begin = 0; begin < order.size();) {
+      size_t end = batching::GroupEnd(hashes, order, begin, num_stripes);
+      ContainsGroup(elems, hashes, order, begin, end, num_stripes, &result);
+      begin = end;
+    }
+    return result;
+  }
+
+private:
+  // Reading without the lock is only safe if the engine never frees storage
+  // under a reader, and if an element can be compared while it is overwritten
+  static constexpr bool kOptimisticReads =
+      Table::kStableStorage && std::is_trivially_copyable<T>::value;
+  // Optimistic reads tried before Contains falls back to taking the lock
+  static constexpr size_t kOptimisticAttempts = 4;
+  // The lock array stops doubling at this many stripes, past which more locks
+  // only cost memory
+  static constexpr size_t kMaxStripes = size_t{1} << 14;
+  // Insertions or removals counted by one cell of |set_size_| between two
+  // checks of the load factor
+  static constexpr size_t kSizeCheckInterval = 32;
+
+  // Current table, owned by the set. With optimistic reads, replaced tables
+  // are retired to |epochs_|, which optimistic readers pin
+  std::atomic<Table *> table;
+  reclamation::EpochDomain epochs_;
+  // Thread resizing the set, marked for as long as the resize lasts
+  AtomicMarkableReference<const int> owner;
+  // Current lock array. Replaced arrays stay alive in |stripe_arrays_| until
+  // the set is destroyed, as other threads may be about to lock one of their
+  // stripes, or sample one of their versions, before finding out that it is
+  // stale
+  std::atomic<Stripes *> stripes_;
+  std::vector<std::unique_ptr<Stripes>> stripe_arrays_;
+  // Guards |stripe_arrays_| against Stats() walking it during a resize
+  mutable std::mutex arrays_mutex_;
+  // The lock array is replaced on resize, so the size cannot be kept per
+  // stripe as in HashSetStriped
+  ShardedCounter set_size_;
+  resizing::LoadFactorPolicy policy_;
+  // The table never shrinks below its initial capacity
+  size_t min_capacity_;
+  stats::ProbeHistogram probes_;
+  stats::ResizeCounters resizes_;
+
+  // Address that identifies the calling thread as the owner of a resize
+  static const int *ThisThread() {
+    static thread_local int token = 0;
+    return &token;
+  }
+
+  bool Resizing() const {
+    bool resizing = false;
+    owner.Get(&resizing);
+    return resizing;
+  }
+
+  // Locks the stripe of |hash| in the current lock array and returns its
+  // mutex. Waits out any resize in progress, and tries again if the array was
+  // replaced or a resize began while the lock was being taken
+  stats::Mutex &Acquire(size_t hash) {
     while (true) {
-      do {
-        current_owner = owner->get(&mark);
-        // Prevents threads from acquiring locks whilst the table is being
-        // resized.
-      } while (mark && current_owner != this_thread);
-      std::vector<std::unique_ptr<std::mutex>> old_mutexes = mutex_ptrs_;
-      std::mutex *old_lock =
-          old_mutexes[std::hash<T>()(elem) % old_mutexes.size()].get();
-      old_lock->lock();
-      current_owner = owner->get(&mark);
-      if (!mark || (current_owner == this_thread)) {
-        return;
-      } else {
-        old_lock->unlock();
+      while (Resizing()) {
+        std::this_thread::yield();
+      }
+      Stripes *stripes = stripes_.load();
+      stats::Mutex &mutex = (*stripes)[hash & (stripes->size() - 1)].mutex;
+      mutex.lock();
+      if (!Resizing() && stripes == stripes_.load()) {
+        return mutex;
       }
+      mutex.unlock();
     }
   }
 
-  // Release specific lock for elem
-  void release(T elem) {
-    mutex_ptrs_[std::hash<T>()(elem) & mutex_ptrs_.size()].get()->unlock();
+  // Waits until no thread holds a lock of the current array. Only called by
+  // the owner of a resize, once the mark keeps new threads from locking
+  void Quiesce() {
+    for (auto &stripe : *stripes_.load()) {
+      while (!stripe.mutex.try_lock()) {
+        std::this_thread::yield();
+      }
+      stripe.mutex.unlock();
+    }
   }
 
-  // Checks all locks are unlocked before the table can be resized.
-  void quiesce() {
-    for (int i = 0; i < mutex_ptrs_.size(); i++) {
-      std::mutex *mutex = mutex_ptrs_[i].get();
-      // loops until mutex is unlocked ()
-      while (!mutex->try_lock()) {
+  // Takes every lock of the current array, in order, until the returned locks
+  // are destroyed
+  std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> LockAll() {
+    while (true) {
+      while (Resizing()) {
+        std::this_thread::yield();
+      }
+      Stripes *stripes = stripes_.load();
+      std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> locks;
+      for (auto &stripe : *stripes) {
+        locks.push_back(
+            std::make_unique<std::scoped_lock<stats::Mutex>>(stripe.mutex));
+      }
+      if (!Resizing() && stripes == stripes_.load()) {
+        return locks;
       }
-      mutex->unlock();
     }
   }
 
-  void Resize2() {
-    /*bool mark = true;
-    std::thread::id this_thread = std::this_thread::get_id();
-    size_t old_size = table.size();
+  // Returns the stripe of |hash| in the current lock array, which cannot be
+  // replaced while the caller holds one of its locks
+  striping::Stripe<> &GetStripe(size_t hash) {
+    Stripes &stripes = *stripes_.load();
+    return stripes[hash & (stripes.size() - 1)];
+  }
 
-    if(owner->CompareAndSet(std::thread::id, this_thread, false, true)) {
-      if (table.size() != old_size){
-        return
-      }
+  // Marks the stripe of |hash| as being modified. Must hold its lock
+  void BeginWrite(size_t hash) { BeginWrite(GetStripe(hash)); }
 
-      quiesce();
+  // Publishes the modification of the stripe of |hash|. Must hold its lock
+  void EndWrite(size_t hash) { EndWrite(GetStripe(hash)); }
 
-      //copy table
-      if (old_size == table.size()) {
-      std::vector<std::vector<T>> old_table = table;
-      table = std::vector<std::vector<T>>(old_table.size() * 2);
-      for (auto &bucket : old_table) {
-        for (auto &elem : bucket) {
-          GetBucket(std::hash<T>()(elem)).push_back(elem);
+  static void BeginWrite(striping::Stripe<> &stripe) {
+    if constexpr (kOptimisticReads) {
+      stripe.version.store(stripe.version.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  }
+
+  static void EndWrite(striping::Stripe<> &stripe) {
+    if constexpr (kOptimisticReads) {
+      stripe.version.store(stripe.version.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+    }
+  }
+
+  // Runs |read| on the current table without locking. Returns false if a
+  // writer was inside the stripe of |hash| at any point, if the lock array or
+  // the table was replaced meanwhile, or if the lock array no longer has the
+  // |num_stripes| stripes the reads were grouped by (0 when there is a single
+  // read), in which case whatever |read| produced must be discarded. A
+  // replaced array is left with odd versions, so a reader that sampled one
+  // after the resize that replaced it also fails. The caller must pin
+  // |epochs_|
+  template <typename Read>
+  bool TryRead(size_t hash, size_t num_stripes, Read read) {
+    Stripes *stripes = stripes_.load(std::memory_order_acquire);
+    if (num_stripes != 0 && stripes->size() != num_stripes) {
+      return false;
+    }
+    std::atomic<size_t> &version =
+        (*stripes)[hash & (stripes->size() - 1)].version;
+    size_t before = version.load(std::memory_order_acquire);
+    if ((before & 1) != 0) {
+      return false;
+    }
+    Table *current = table.load(std::memory_order_acquire);
+    read(*current);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == before &&
+           stripes_.load(std::memory_order_relaxed) == stripes &&
+           table.load(std::memory_order_relaxed) == current;
+  }
+
+  // Looks up |key|, an element or a key comparing equal to elements
+  template <typename K> bool ContainsKey(const K &key) {
+    size_t key_hash = Hash()(key);
+    if constexpr (kOptimisticReads) {
+      bool found = false;
+      auto read = [&](const Table &current) {
+        found = current.Contains(key_hash, key);
+      };
+      auto guard = epochs_.Pin();
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryRead(key_hash, 0, read)) {
+          return found;
         }
       }
+    }
+    std::scoped_lock<stats::Mutex> scopedLock(std::adopt_lock,
+                                              Acquire(key_hash));
+    return table.load()->Contains(key_hash, key);
+  }
 
-      //copy locks and duplicate locks here too
+  // Inserts elems[order[begin, end)], which all belong to the same stripe of
+  // an array of |num_stripes|, under one acquisition of that stripe's lock.
+  // Once the lock array has grown the group spans several stripes, so the
+  // rest of it is added one element at a time
+  size_t AddGroup(const std::vector<T> &elems,
+                  const std::vector<size_t> &hashes,
+                  const std::vector<size_t> &order, size_t begin, size_t end,
+                  size_t num_stripes) {
+    size_t stripe_hash = hashes[order[begin]];
+    std::unique_lock<stats::Mutex> uniqueLock(Acquire(stripe_hash),
+                                              std::adopt_lock);
+    if (stripes_.load()->size() != num_stripes) {
+      uniqueLock.unlock();
+      return AddEach(elems, order, begin, end);
+    }
+    BeginWrite(stripe_hash);
+    Table *current = table.load();
+    size_t added = 0;
+    bool grow = false;
+    for (size_t i = begin; i < end; i++) {
+      PrefetchAhead(*current, hashes, order, i, end);
+      size_t hash = hashes[order[i]];
+      if (grow || current->Full(hash)) {
+        // Grow now rather than after the group, which may be large enough to
+        // need several doublings
+        EndWrite(stripe_hash);
+        size_t capacity = current->Capacity();
+        uniqueLock.unlock();
+        Resize(capacity);
+        return added + AddEach(elems, order, i, end);
+      }
+      if (current->Insert(hash, elems[order[i]])) {
+        added++;
+        grow = Policy(hash, set_size_.Increment());
+      }
+    }
+    EndWrite(stripe_hash);
+    if (grow) {
+      size_t capacity = current->Capacity();
+      uniqueLock.unlock();
+      Resize(capacity);
+    }
+    return added;
+  }
+
+  // Removes elems[order[begin, end)] under one acquisition of their lock,
+  // falling back to single removals as AddGroup does
+  size_t RemoveGroup(const std::vector<T> &elems,
+                     const std::vector<size_t> &hashes,
+                     const std::vector<size_t> &order, size_t begin,
+                     size_t end, size_t num_stripes) {
+    size_t stripe_hash = hashes[order[begin]];
+    std::unique_lock<stats::Mutex> uniqueLock(Acquire(stripe_hash),
+                                              std::adopt_lock);
+    if (stripes_.load()->size() != num_stripes) {
+      uniqueLock.unlock();
+      size_t removed = 0;
+      for (size_t i = begin; i < end; i++) {
+        if (Remove(elems[order[i]])) {
+          removed++;
+        }
+      }
+      return removed;
+    }
+    BeginWrite(stripe_hash);
+    Table *current = table.load();
+    size_t removed = 0;
+    bool shrink = false;
+    for (size_t i = begin; i < end; i++) {
+      PrefetchAhead(*current, hashes, order, i, end);
+      if (current->Erase(hashes[order[i]], elems[order[i]])) {
+        shrink = ShrinkPolicy(set_size_.Decrement()) || shrink;
+        removed++;
+      }
+    }
+    EndWrite(stripe_hash);
+    if (shrink) {
+      uniqueLock.unlock();
+      Shrink();
+    }
+    return removed;
+  }
 
+  // Looks up elems[order[begin, end)], first optimistically and otherwise
+  // under one acquisition of their lock, or one by one if the lock array has
+  // grown since they were grouped
+  void ContainsGroup(const std::vector<T> &elems,
+                     const std::vector<size_t> &hashes,
+                     const std::vector<size_t> &order, size_t begin,
+                     size_t end, size_t num_stripes,
+                     std::vector<bool> *result) {
+    size_t stripe_hash = hashes[order[begin]];
+    auto read = [&](const Table &current) {
+      for (size_t i = begin; i < end; i++) {
+        PrefetchAhead(current, hashes, order, i, end);
+        (*result)[order[i]] =
+            current.Contains(hashes[order[i]], elems[order[i]]);
+      }
+    };
+    if constexpr (kOptimisticReads) {
+      auto guard = epochs_.Pin();
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryRead(stripe_hash, num_stripes, read)) {
+          return;
+        }
+      }
+    }
+    std::unique_lock<stats::Mutex> uniqueLock(Acquire(stripe_hash),
+                                              std::adopt_lock);
+    if (stripes_.load()->size() == num_stripes) {
+      read(*table.load());
+      return;
+    }
+    uniqueLock.unlock();
+    for (size_t i = begin; i < end; i++) {
+      (*result)[order[i]] = Contains(elems[order[i]]);
+    }
+  }
 
+  // Adds elems[order[begin, end)] one at a time
+  size_t AddEach(const std::vector<T> &elems, const std::vector<size_t> &order,
+                 size_t begin, size_t end) {
+    size_t added = 0;
+    for (size_t i = begin; i < end; i++) {
+      if (Add(elems[order[i]])) {
+        added++;
+      }
     }
+    return added;
+  }
 
-    } */
+  // Prefetches the bucket of the element batching::kPrefetchDistance after
+  // position |i| of a group ending at |end|
+  static void PrefetchAhead(const Table &current,
+                            const std::vector<size_t> &hashes,
+                            const std::vector<size_t> &order, size_t i,
+                            size_t end) {
+    if (i + batching::kPrefetchDistance < end) {
+      current.Prefetch(hashes[order[i + batching::kPrefetchDistance]]);
+    }
   }
 
-  std::vector<T> &GetBucket(size_t hash) { return table[hash % table.size()]; }
+  // The region of |hash| cannot take another element, or the table exceeds
+  // the maximum load of the policy. The size is only summed when |cell_size|,
+  // the count in the caller's cell after its insertion, reaches a multiple of
+  // kSizeCheckInterval. The caller must hold a lock
+  bool Policy(size_t hash, size_t cell_size) {
+    Table *current = table.load();
+    return current->Full(hash) ||
+           (cell_size % kSizeCheckInterval == 0 &&
+            policy_.ShouldGrow(set_size_.Sum(), current->Capacity()));
+  }
 
-  // returns the the mutex corresponding to the hash,
-  std::mutex *GetLock(size_t hash) {
-    return mutex_ptrs_[hash % mutex_ptrs_.size()].get();
+  // The table fell below the minimum load of the policy. As with growth, the
+  // size is only summed when |cell_size|, the count in the caller's cell after
+  // its removal, reaches a multiple of kSizeCheckInterval. The caller must
+  // hold a lock
+  bool ShrinkPolicy(size_t cell_size) {
+    return cell_size % kSizeCheckInterval == 0 &&
+           policy_.ShouldShrink(set_size_.Sum(), table.load()->Capacity(),
+                                min_capacity_);
   }
 
-  // Average length of bucket is greater than 4
-  bool Policy() { return set_size / table.size(); }
+  // Doubles the table, and the lock array along with it until the array
+  // reaches kMaxStripes. |old_capacity| is the capacity the caller saw under
+  // its lock, so that a resize that finished in the meantime is not repeated.
+  // Assumes no locks are held
+  void Resize(size_t old_capacity) {
+    Rebuild([&](size_t current) {
+      return current == old_capacity ? current * 2 : current;
+    });
+  }
 
-  // Doubles bucket vector and puts elements into new buckets
-  void Resize() {
-    size_t old_size = table.size();
+  // Shrinks the table if it is still underloaded once every lock is free.
+  // Assumes no locks are held
+  void Shrink() {
+    Rebuild([&](size_t current) {
+      size_t size = set_size_.Sum();
+      if (!policy_.ShouldShrink(size, current, min_capacity_)) {
+        return current;
+      }
+      return policy_.ShrunkCapacity(size, current, min_capacity_);
+    });
+  }
 
-    // Locks every mutex in a list of scopedlocks, ensures the set is not
-    // modified during resizing.
-    // These locks are unlocked once resising finishes (assumes no locks are
-    // held)
-    std::vector<std::unique_ptr<std::scoped_lock<std::mutex>>> locks;
-    for (size_t i = 0; i < mutex_ptrs_.size(); i++) {
-      locks.push_back(
-          std::make_unique<std::scoped_lock<std::mutex>>(*mutex_ptrs_[i]));
+  // Rebuilds the table with the capacity |target| picks given the current
+  // one, or leaves it as is if |target| returns the current capacity. The lock
+  // array doubles whenever the table grows. Only the thread that marks
+  // |owner| rebuilds; any other returns false at once and waits for the owner
+  // in Acquire. Assumes no locks are held. Large tables are rebuilt by
+  // several threads, a region of the old lock array each. With optimistic
+  // reads, the old table is then retired, and freed here unless a reader is
+  // still pinned
+  template <typename Target> bool Rebuild(Target target) {
+    if (!owner.CompareAndSet(nullptr, ThisThread(), false, true)) {
+      return false;
     }
+    stats::ResizeScope resize_scope(&resizes_);
+    Quiesce();
+    resize_scope.Exclusive();
+    Table *current = table.load();
+    size_t capacity = target(current->Capacity());
+    if (capacity != current->Capacity()) {
+      Stripes *old_stripes = stripes_.load();
+      size_t num_stripes = old_stripes->size();
+      if (capacity > current->Capacity() && num_stripes < kMaxStripes) {
+        num_stripes *= 2;
+      }
+      resizing::ParallelFor parallel_for(resizing::RehashWorkers(Size()));
+      if constexpr (kOptimisticReads) {
+        auto rebuilt = std::make_unique<Table>(
+            current->Rehashed(capacity, num_stripes, parallel_for));
+        for (auto &stripe : *old_stripes) {
+          BeginWrite(stripe);
+        }
+        table = rebuilt.release();
+        ReplaceStripes(num_stripes);
+        // A replaced array keeps its odd versions for good, so that no
+        // reader still holding it validates a read of the new table
+        if (stripes_.load() == old_stripes) {
+          for (auto &stripe : *old_stripes) {
+            EndWrite(stripe);
+          }
+        }
+        epochs_.Retire(current);
+      } else {
+        current->Rehash(capacity, num_stripes, parallel_for);
+        ReplaceStripes(num_stripes);
+      }
+    }
+    owner.Set(nullptr, false);
+    epochs_.Collect();
+    return true;
+  }
 
-    if (old_size == table.size()) {
-      std::vector<std::vector<T>> old_table = table;
-      table = std::vector<std::vector<T>>(old_table.size() * 2);
-      for (auto &bucket : old_table) {
-        for (auto &elem : bucket) {
-          GetBucket(std::hash<T>()(elem)).push_back(elem);
+  // The set is walked a stripe of the current lock array at a time
+  [[nodiscard]] size_t NumParts() final { return stripes_.load()->size(); }
+
+  // Copies the elements whose stripe was |part| when the lock array had
+  // |num_parts| stripes. The array may have doubled since, in which case the
+  // part spans every stripe congruent to |part|, which are locked together.
+  // Reads optimistically if the engine allows it and the array is unchanged
+  void CopyPart(size_t part, size_t num_parts, std::vector<T> *out) final {
+    size_t begin = out->size();
+    auto read = [&](const Table &current, size_t num_stripes) {
+      out->erase(out->begin() + static_cast<std::ptrdiff_t>(begin),
+                 out->end());
+      for (size_t region = part; region < num_stripes; region += num_parts) {
+        current.ForEachInRegion(region,
+                                [&](const T &elem) { out->push_back(elem); });
+      }
+    };
+    if constexpr (kOptimisticReads) {
+      auto read_part = [&](const Table &current) { read(current, num_parts); };
+      auto guard = epochs_.Pin();
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryRead(part, num_parts, read_part)) {
+          return;
         }
       }
     }
+    auto locks = LockPart(part, num_parts);
+    read(*table.load(), stripes_.load()->size());
+  }
+
+  // Takes, in order, the locks of the current array whose index is congruent
+  // to |part| modulo |num_parts|, until the returned locks are destroyed
+  std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>>
+  LockPart(size_t part, size_t num_parts) {
+    while (true) {
+      while (Resizing()) {
+        std::this_thread::yield();
+      }
+      Stripes *stripes = stripes_.load();
+      std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> locks;
+      for (size_t i = part; i < stripes->size(); i += num_parts) {
+        locks.push_back(std::make_unique<std::scoped_lock<stats::Mutex>>(
+            (*stripes)[i].mutex));
+      }
+      if (!Resizing() && stripes == stripes_.load()) {
+        return locks;
+      }
+    }
+  }
+
+  // Installs a fresh lock array of |num_stripes| unless the current one
+  // already has that many. Only called by the owner of a resize
+  void ReplaceStripes(size_t num_stripes) {
+    if (stripes_.load()->size() != num_stripes) {
+      auto stripes = std::make_unique<Stripes>(num_stripes);
+      stripes_ = stripes.get();
+      std::scoped_lock<std::mutex> arraysLock(arrays_mutex_);
+      stripe_arrays_.push_back(std::move(stripes));
+    }
   }
 };
 
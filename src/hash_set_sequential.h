@@ -2,87 +2,141 @@
 #define HASH_SET_SEQUENTIAL_H
 
 #include <cassert>
-#include <vector>
+#include <functional>
+#include <type_traits>
+#include <utility>
 
+#include "src/chained_table.h"
 #include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/resizing.h"
+#include "src/stats.h"
+
+// |Table| is the bucket storage engine: ChainedTable, OpenAddressingTable or
+// SwissTable, instantiated with the set's |Hash| and |KeyEqual|. The table
+// grows and shrinks within the load factors of |policy|, see src/resizing.h
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Table = ChainedTable<T, Hash, KeyEqual>>
+class HashSetSequential : public HashSetBase<T> {
+  static_assert(std::is_same<typename Table::hasher, Hash>::value &&
+                    std::is_same<typename Table::key_equal, KeyEqual>::value,
+                "Table must hash and compare elements as the set does");
 
-template <typename T> class HashSetSequential : public HashSetBase<T> {
 public:
-  explicit HashSetSequential(size_t initial_capacity) {
-    table = std::vector<std::vector<T>>(initial_capacity);
+  explicit HashSetSequential(size_t initial_capacity,
+                             resizing::LoadFactorPolicy policy = {4, 0.5})
+      : table(initial_capacity), policy_(policy.For(Table::kMaxLoad)) {
     set_size_ = 0;
+    min_capacity_ = table.Capacity();
+    table.AttachProbes(&probes_);
   }
 
   // Finds the bucket corresponding to the elems hash and inserts the element to
   // that bucket
   bool Add(T elem) final {
-    std::vector<T> &bucket = GetBucket(elem);
-    if (VectorContains(bucket, elem)) {
+    size_t elem_hash = Hash()(elem);
+    if (!table.Insert(elem_hash, std::move(elem))) {
       return false;
-    } else {
-      bucket.push_back(elem);
-      set_size_++;
-      if (Policy()) {
-        Resize();
-      }
-      return true;
     }
+    set_size_++;
+    if (Policy(elem_hash)) {
+      Resize();
+    }
+    return true;
   }
 
   // Finds the bucket corresponding to the elems hash and removes the element
   // from that bucket
-  bool Remove(T elem) final {
-    std::vector<T> &bucket = GetBucket(elem);
-    for (auto it = bucket.begin(); it != bucket.end(); it++) {
-      if (*it == elem) {
-        bucket.erase(it);
-        set_size_--;
-        return true;
-      }
+  bool Remove(const T &elem) final {
+    if (!table.Erase(Hash()(elem), elem)) {
+      return false;
     }
-    return false;
+    set_size_--;
+    if (policy_.ShouldShrink(set_size_, table.Capacity(), min_capacity_)) {
+      Rehash(policy_.ShrunkCapacity(set_size_, table.Capacity(),
+                                    min_capacity_));
+    }
+    return true;
   }
 
   // Returns true iffthe element is contained in the HashSet and false otherwise
-  [[nodiscard]] bool Contains(T elem) final {
-    std::vector<T> &bucket = GetBucket(elem);
-    return VectorContains(bucket, elem);
+  [[nodiscard]] bool Contains(const T &elem) final {
+    return table.Contains(Hash()(elem), elem);
+  }
+
+  // Looks up |key| without converting it to T, given a transparent Hash and
+  // KeyEqual such as hashing::StringHash and std::equal_to<>
+  template <typename K, typename = std::enable_if_t<
+                            hashing::IsTransparent<Hash, KeyEqual, K>::value>>
+  [[nodiscard]] bool Contains(const K &key) {
+    return table.Contains(Hash()(key), key);
   }
 
   // Returns the total amount of elements in hashset
   [[nodiscard]] size_t Size() const final { return set_size_; }
 
-private:
-  size_t set_size_;
-  std::vector<std::vector<T>> table;
-
-  // Helper to Contains returning true iff an element is contained in a bucket
-  bool VectorContains(std::vector<T> &v, const T &elem) {
-    for (auto it = v.begin(); it != v.end(); it++) {
-      if (*it == elem) {
-        return true;
-      }
+  // Grows the table to hold |capacity| elements within the maximum load
+  void Reserve(size_t capacity) final {
+    capacity = policy_.CapacityFor(capacity, min_capacity_);
+    if (capacity > table.Capacity()) {
+      Rehash(capacity);
+    }
+  }
+
+  // Shrinks the table to the smallest capacity holding the elements within
+  // the maximum load
+  void ShrinkToFit() final {
+    size_t capacity = policy_.CapacityFor(set_size_, min_capacity_);
+    if (hashing::RoundUpToPowerOfTwo(capacity) < table.Capacity()) {
+      Rehash(capacity);
     }
-    return false;
   }
 
-  // Returns corresponding bucket for elem based on it's hash
-  std::vector<T> &GetBucket(T elem) {
-    return table[std::hash<T>()(elem) % table.size()];
+  // Returns the probe lengths and the resizes. Empty unless built with
+  // HASH_SET_STATS
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    if constexpr (stats::kEnabled) {
+      probes_.CopyTo(&snapshot);
+      resizes_.CopyTo(&snapshot);
+    }
+    return snapshot;
   }
 
-  // Average length of bucket is greater than 4
-  bool Policy() { return set_size_ / table.size() > 4; }
+private:
+  size_t set_size_;
+  Table table;
+  resizing::LoadFactorPolicy policy_;
+  // The table never shrinks below its initial capacity
+  size_t min_capacity_;
+  stats::ProbeHistogram probes_;
+  stats::ResizeCounters resizes_;
+
+  // The load exceeds the maximum of the policy, or the storage cannot take
+  // another element with this hash
+  bool Policy(size_t hash) {
+    return policy_.ShouldGrow(set_size_, table.Capacity()) || table.Full(hash);
+  }
 
   // Doubles bucket vector and puts elements into new buckets
   void Resize() {
-    std::vector<std::vector<T>> old_table = table;
-    table = std::vector<std::vector<T>>(old_table.size() * 2);
-    for (auto &bucket : old_table) {
-      for (auto &elem : bucket) {
-        GetBucket(elem).push_back(elem);
-      }
-    }
+    stats::ResizeScope resize_scope(&resizes_);
+    table.Grow();
+  }
+
+  // Rebuilds the table with |capacity|, larger or smaller than the current one
+  void Rehash(size_t capacity) {
+    stats::ResizeScope resize_scope(&resizes_);
+    table.Rehash(capacity, 1);
+  }
+
+  // The set is walked in a single part
+  [[nodiscard]] size_t NumParts() final { return 1; }
+
+  void CopyPart(size_t /*part*/, size_t /*num_parts*/,
+                std::vector<T> *out) final {
+    table.ForEach([&](const T &elem) { out->push_back(elem); });
   }
 };
 
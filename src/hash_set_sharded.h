@@ -0,0 +1,229 @@
+#ifndef HASH_SET_SHARDED_H
+#define HASH_SET_SHARDED_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/hash_set_base.h"
+#include "src/hash_set_striped.h"
+#include "src/hashing.h"
+#include "src/numa.h"
+#include "src/stats.h"
+
+// How HashSetSharded splits its elements
+namespace sharding {
+
+struct ShardPolicy {
+  // Number of shards, rounded up to a power of two, or 0 for one per NUMA
+  // node
+  size_t num_shards = 0;
+  // Builds shard i on NUMA node i % numa::NumNodes(), see numa::RunOnNode.
+  // Has no effect on a single node
+  bool place_on_nodes = true;
+};
+
+} // namespace sharding
+
+// Front end splitting the elements between independent shards, each an
+// |Inner| set such as HashSetStriped that hashes and compares elements with
+// |Hash| and |KeyEqual|. The shard of an element is picked by the top bits of
+// its remixed hash, leaving the low bits, which the shards index their own
+// tables with, evenly spread.
+//
+// Every shard is built, and later reserved and shrunk, on a thread bound to
+// its NUMA node, so that its table and locks live in that node's memory
+// rather than wherever the constructing thread happened to run. Memory a
+// shard allocates as it grows on its own follows the thread that grows it, so
+// sets filled from every node should be sized up front with Reserve. Callers
+// that pin their threads can route the operations on an element to a thread
+// of NodeOf(elem), which keeps the cache lines of every shard on one socket.
+//
+// Shards share nothing, so operations on different shards never contend.
+// Size, SizeExact and ForEach visit the shards one after the other, so they
+// are exact per shard but not a snapshot of the whole set.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Inner = HashSetStriped<T, Hash, KeyEqual>>
+class HashSetSharded : public HashSetBase<T> {
+public:
+  explicit HashSetSharded(size_t initial_capacity,
+                          sharding::ShardPolicy policy = {}) {
+    size_t num_nodes = numa::NumNodes();
+    size_t num_shards = hashing::RoundUpToPowerOfTwo(
+        policy.num_shards != 0 ? policy.num_shards : num_nodes);
+    shard_bits_ = hashing::Log2(num_shards);
+    place_on_nodes_ = policy.place_on_nodes && num_nodes > 1;
+    shards_.resize(num_shards);
+    for (size_t i = 0; i < num_shards; i++) {
+      Shard &shard = shards_[i];
+      shard.node = i % num_nodes;
+      OnNode(shard, [&] {
+        shard.set = std::make_unique<Inner>(ShardCapacity(initial_capacity));
+      });
+    }
+  }
+
+  bool Add(T elem) final {
+    return ShardOf(Hash()(elem)).Add(std::move(elem));
+  }
+
+  bool Remove(const T &elem) final {
+    return ShardOf(Hash()(elem)).Remove(elem);
+  }
+
+  [[nodiscard]] bool Contains(const T &elem) final {
+    return ShardOf(Hash()(elem)).Contains(elem);
+  }
+
+  // Returns the sum of the shard sizes
+  [[nodiscard]] size_t Size() const final {
+    size_t size = 0;
+    for (const auto &shard : shards_) {
+      size += shard.set->Size();
+    }
+    return size;
+  }
+
+  // Returns the sum of the exact shard sizes, each taken in turn
+  [[nodiscard]] size_t SizeExact() final {
+    size_t size = 0;
+    for (auto &shard : shards_) {
+      size += shard.set->SizeExact();
+    }
+    return size;
+  }
+
+  // Returns the counts of every shard, merged lock by lock
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    for (const auto &shard : shards_) {
+      snapshot.Merge(shard.set->Stats());
+    }
+    return snapshot;
+  }
+
+  // Splits |elems| by shard and hands every shard its batch
+  size_t AddAll(const std::vector<T> &elems) final {
+    std::vector<std::vector<T>> batches = SplitByShard(elems);
+    size_t added = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+      if (!batches[i].empty()) {
+        added += shards_[i].set->AddAll(batches[i]);
+      }
+    }
+    return added;
+  }
+
+  size_t RemoveAll(const std::vector<T> &elems) final {
+    std::vector<std::vector<T>> batches = SplitByShard(elems);
+    size_t removed = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+      if (!batches[i].empty()) {
+        removed += shards_[i].set->RemoveAll(batches[i]);
+      }
+    }
+    return removed;
+  }
+
+  [[nodiscard]] std::vector<bool>
+  ContainsMany(const std::vector<T> &elems) final {
+    std::vector<std::vector<size_t>> indices(shards_.size());
+    std::vector<std::vector<T>> batches(shards_.size());
+    for (size_t i = 0; i < elems.size(); i++) {
+      size_t shard = ShardIndex(Hash()(elems[i]));
+      indices[shard].push_back(i);
+      batches[shard].push_back(elems[i]);
+    }
+    std::vector<bool> result(elems.size());
+    for (size_t shard = 0; shard < shards_.size(); shard++) {
+      if (batches[shard].empty()) {
+        continue;
+      }
+      std::vector<bool> found =
+          shards_[shard].set->ContainsMany(batches[shard]);
+      for (size_t i = 0; i < found.size(); i++) {
+        result[indices[shard][i]] = found[i];
+      }
+    }
+    return result;
+  }
+
+  // Reserves an even share of |capacity| in every shard, on its node
+  void Reserve(size_t capacity) final {
+    for (auto &shard : shards_) {
+      OnNode(shard, [&] { shard.set->Reserve(ShardCapacity(capacity)); });
+    }
+  }
+
+  // Shrinks every shard on its node
+  void ShrinkToFit() final {
+    for (auto &shard : shards_) {
+      OnNode(shard, [&] { shard.set->ShrinkToFit(); });
+    }
+  }
+
+  [[nodiscard]] size_t NumShards() const { return shards_.size(); }
+
+  // Returns the NUMA node holding the shard of |elem|
+  [[nodiscard]] size_t NodeOf(const T &elem) const {
+    return shards_[ShardIndex(Hash()(elem))].node;
+  }
+
+private:
+  struct Shard {
+    std::unique_ptr<Inner> set;
+    size_t node = 0;
+  };
+
+  std::vector<Shard> shards_;
+  // Log2 of the number of shards
+  size_t shard_bits_;
+  bool place_on_nodes_;
+
+  size_t ShardIndex(size_t hash) const {
+    if (shard_bits_ == 0) {
+      return 0;
+    }
+    return static_cast<size_t>(hashing::Mix64(hash) >> (64 - shard_bits_));
+  }
+
+  Inner &ShardOf(size_t hash) { return *shards_[ShardIndex(hash)].set; }
+
+  size_t ShardCapacity(size_t capacity) const {
+    return (capacity + shards_.size() - 1) / shards_.size();
+  }
+
+  // Runs |work| on a thread of the node of |shard|, or on the calling thread
+  // if shards are not placed
+  template <typename Work> void OnNode(const Shard &shard, Work work) {
+    if (place_on_nodes_) {
+      numa::RunOnNode(shard.node, work);
+    } else {
+      work();
+    }
+  }
+
+  std::vector<std::vector<T>> SplitByShard(const std::vector<T> &elems) const {
+    std::vector<std::vector<T>> batches(shards_.size());
+    for (const T &elem : elems) {
+      batches[ShardIndex(Hash()(elem))].push_back(elem);
+    }
+    return batches;
+  }
+
+  // The set is walked a shard at a time, each in all of its own parts
+  [[nodiscard]] size_t NumParts() final { return shards_.size(); }
+
+  void CopyPart(size_t part, size_t /*num_parts*/, std::vector<T> *out) final {
+    Inner &shard = *shards_[part].set;
+    size_t num_parts = HashSetBase<T>::NumPartsOf(shard);
+    for (size_t i = 0; i < num_parts; i++) {
+      HashSetBase<T>::CopyPartOf(shard, i, num_parts, out);
+    }
+  }
+};
+
+#endif // HASH_SET_SHARDED_H
@@ -3,119 +3,532 @@
 
 #include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "src/batching.h"
+#include "src/chained_table.h"
 #include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/locking.h"
+#include "src/reclamation.h"
+#include "src/resizing.h"
+#include "src/stats.h"
+#include "src/striping.h"
+
+// |Table| is the bucket storage engine: ChainedTable, OpenAddressingTable or
+// SwissTable, instantiated with the set's |Hash| and |KeyEqual|. The table is
+// split into one region per stripe, and the number of stripes does not depend
+// on the capacity. |Lock| is the lock policy of the stripes, see
+// src/locking.h. The table grows and shrinks within the load factors of
+// |policy|, see src/resizing.h; both take every stripe lock.
+//
+// With a storage engine whose memory is only released on Grow, Contains does
+// not take the stripe lock. Every stripe has a version counter that writers
+// make odd while they modify the stripe; readers search the table without
+// locking and only retry, falling back to the lock after a few attempts, if
+// the version changed in the meantime. Otherwise, or after those attempts, it
+// takes the stripe lock, in shared mode if |Lock| is a reader-writer lock.
+// The table is then rebuilt into a new one, published by swapping a pointer,
+// and the old one is retired to a reclamation::EpochDomain that optimistic
+// readers pin, so it is freed once no reader can still be searching it.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Table = ChainedTable<T, Hash, KeyEqual>,
+          typename Lock = stats::Mutex>
+class HashSetStriped : public HashSetBase<T> {
+  static_assert(std::is_same<typename Table::hasher, Hash>::value &&
+                    std::is_same<typename Table::key_equal, KeyEqual>::value,
+                "Table must hash and compare elements as the set does");
 
-template <typename T> class HashSetStriped : public HashSetBase<T> {
 public:
-  explicit HashSetStriped(size_t initial_capacity) {
-    table_ = std::vector<std::vector<T>>(initial_capacity);
-    set_size_ = 0;
-    for (size_t i = 0; i < initial_capacity; i++) {
-      mutex_ptrs_.push_back(std::make_unique<std::mutex>());
-    }
+  // |num_stripes| is rounded up to a power of two
+  explicit HashSetStriped(size_t initial_capacity,
+                          size_t num_stripes = striping::DefaultStripeCount(),
+                          resizing::LoadFactorPolicy policy = {1, 0.125})
+      : stripes_(hashing::RoundUpToPowerOfTwo(num_stripes)),
+        policy_(policy.For(Table::kMaxLoad)) {
+    table_ = new Table(initial_capacity, stripes_.size());
+    min_capacity_ = table_.load()->Capacity();
+    table_.load()->AttachProbes(&probes_);
   }
 
+  HashSetStriped(const HashSetStriped &) = delete;
+  HashSetStriped &operator=(const HashSetStriped &) = delete;
+
+  ~HashSetStriped() override { delete table_.load(); }
+
   // Finds the bucket corresponding to the elems hash and inserts the element to
   // that bucket Unique lock is needed here to unlock before call to Resize()
   bool Add(T elem) final {
-    size_t elem_hash = std::hash<T>()(elem);
-    std::unique_lock<std::mutex> uniqueLock(*GetLock(elem_hash));
-    std::vector<T> &bucket = GetBucket(elem_hash);
-    if (VectorContains(bucket, elem)) {
+    size_t elem_hash = Hash()(elem);
+    std::unique_lock<Lock> uniqueLock(*GetLock(elem_hash));
+    while (table_.load()->Full(elem_hash)) {
+      // Other threads filled the region of this element before the table
+      // grew, so make room first
+      size_t capacity = table_.load()->Capacity();
+      uniqueLock.unlock();
+      Resize(capacity);
+      uniqueLock.lock();
+    }
+    BeginWrite(elem_hash);
+    bool inserted = table_.load()->Insert(elem_hash, std::move(elem));
+    EndWrite(elem_hash);
+    if (!inserted) {
       return false;
-    } else {
-      bucket.push_back(elem);
-      set_size_++;
-      if (Policy()) {
-        // Cannot hold any locks when calling resize as
-        uniqueLock.unlock();
-        Resize();
-      }
-      return true;
     }
+    GetStripe(elem_hash).AddToSize(1);
+    if (Policy(elem_hash)) {
+      // Cannot hold any locks when calling resize as
+      size_t capacity = table_.load()->Capacity();
+      uniqueLock.unlock();
+      Resize(capacity);
+    }
+    return true;
   }
 
   // Finds the bucket corresponding to the elems hash and removes the element
   // from that bucket
-  bool Remove(T elem) final {
-    size_t elem_hash = std::hash<T>()(elem);
-    std::scoped_lock<std::mutex> scopedLock(*GetLock(elem_hash));
-    std::vector<T> &bucket = GetBucket(elem_hash);
-    for (auto it = bucket.begin(); it != bucket.end(); it++) {
-      if (*it == elem) {
-        bucket.erase(it);
-        set_size_--;
-        return true;
-      }
+  bool Remove(const T &elem) final {
+    size_t elem_hash = Hash()(elem);
+    std::unique_lock<Lock> uniqueLock(*GetLock(elem_hash));
+    BeginWrite(elem_hash);
+    bool erased = table_.load()->Erase(elem_hash, elem);
+    EndWrite(elem_hash);
+    if (!erased) {
+      return false;
+    }
+    GetStripe(elem_hash).SubtractFromSize(1);
+    if (ShrinkPolicy(elem_hash)) {
+      uniqueLock.unlock();
+      Shrink();
     }
-    return false;
+    return true;
   }
 
   // Returns true if the element is contained in the HashSet and false otherwise
-  [[nodiscard]] bool Contains(T elem) final {
-    size_t elem_hash = std::hash<T>()(elem);
-    std::scoped_lock<std::mutex> scopedLock(*GetLock(elem_hash));
-    return VectorContains(GetBucket(elem_hash), elem);
+  [[nodiscard]] bool Contains(const T &elem) final {
+    return ContainsKey(elem);
   }
 
-  // Returns total size of HashSet
-  [[nodiscard]] size_t Size() const final { return set_size_; }
+  // Looks up |key| without converting it to T, given a transparent Hash and
+  // KeyEqual such as hashing::StringHash and std::equal_to<>
+  template <typename K, typename = std::enable_if_t<
+                            hashing::IsTransparent<Hash, KeyEqual, K>::value>>
+  [[nodiscard]] bool Contains(const K &key) {
+    return ContainsKey(key);
+  }
 
-private:
-  std::atomic<std::size_t> set_size_;
-  std::vector<std::vector<T>> table_;
-  // List of mutexes corresponding to every initial bucket bucket
-  std::vector<std::unique_ptr<std::mutex>> mutex_ptrs_;
-
-  // Helper to Contains returning true iff an element is contained in a bucket
-  bool VectorContains(std::vector<T> &v, const T &elem) {
-    for (auto it = v.begin(); it != v.end(); it++) {
-      if (*it == elem) {
-        return true;
+  // Returns total size of HashSet, summing the stripe counts without locking,
+  // so it may be off while other threads are modifying the set
+  [[nodiscard]] size_t Size() const final {
+    size_t size = 0;
+    for (const auto &stripe : stripes_) {
+      size += stripe.size.load(std::memory_order_relaxed);
+    }
+    return size;
+  }
+
+  // Sums the element counts of the stripes while holding every stripe lock
+  [[nodiscard]] size_t SizeExact() final {
+    auto locks = LockAll();
+    return Size();
+  }
+
+  // Grows the table to hold |capacity| elements within the maximum load
+  void Reserve(size_t capacity) final {
+    capacity = policy_.CapacityFor(capacity, min_capacity_);
+    Rebuild([&](size_t current) {
+      return capacity > current ? capacity : current;
+    });
+  }
+
+  // Shrinks the table to the smallest capacity holding the elements within
+  // the maximum load
+  void ShrinkToFit() final {
+    Rebuild([&](size_t current) {
+      size_t capacity = policy_.CapacityFor(Size(), min_capacity_);
+      return hashing::RoundUpToPowerOfTwo(capacity) < current ? capacity
+                                                              : current;
+    });
+  }
+
+  // Returns the counts of every stripe lock, the probe lengths and the
+  // resizes. Empty unless built with HASH_SET_STATS
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    if constexpr (stats::kEnabled) {
+      for (const auto &stripe : stripes_) {
+        snapshot.locks.push_back(stats::CountsOf(stripe.mutex));
       }
+      probes_.CopyTo(&snapshot);
+      resizes_.CopyTo(&snapshot);
     }
-    return false;
+    return snapshot;
   }
 
-  std::vector<T> &GetBucket(size_t hash) {
-    return table_[hash % table_.size()];
+  // Hashes every element up front and groups the elements by stripe, so that
+  // each stripe lock is taken once per batch
+  size_t AddAll(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    std::vector<size_t> order =
+        batching::GroupByStripe(hashes, stripes_.size());
+    size_t added = 0;
+    for (size_t begin = 0; begin < order.size();) {
+      size_t end =
+          batching::GroupEnd(hashes, order, begin, stripes_.size());
+      added += AddGroup(elems, hashes, order, begin, end);
+      begin = end;
+    }
+    return added;
   }
 
-  // returns the the mutex corresponding to the hash,
-  std::mutex *GetLock(size_t hash) {
-    return mutex_ptrs_[hash % mutex_ptrs_.size()].get();
+  // Removes the elements stripe by stripe, as AddAll does
+  size_t RemoveAll(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    std::vector<size_t> order =
+        batching::GroupByStripe(hashes, stripes_.size());
+    size_t removed = 0;
+    for (size_t begin = 0; begin < order.size();) {
+      size_t end =
+          batching::GroupEnd(hashes, order, begin, stripes_.size());
+      removed += RemoveGroup(elems, hashes, order, begin, end);
+      begin = end;
+    }
+    return removed;
+  }
+
+  // Looks the elements up stripe by stripe, validating a whole stripe's worth
+  // of optimistic reads at once
+  [[nodiscard]] std::vector<bool>
+  ContainsMany(const std::vector<T> &elems) final {
+    std::vector<size_t> hashes = batching::HashAll<Hash>(elems);
+    std::vector<size_t> order =
+        batching::GroupByStripe(hashes, stripes_.size());
+    std::vector<bool> result(elems.size());
+    for (size_t begin = 0; begin < order.size();) {
+      size_t end =
+          batching::GroupEnd(hashes, order, begin, stripes_.size());
+      ContainsGroup(elems, hashes, order, begin, end, &result);
+      begin = end;
+    }
+    return result;
   }
 
-  // Average length of bucket is greater than 4
-  bool Policy() { return set_size_ / table_.size(); }
+private:
+  // Reading without the lock is only safe if the engine never frees storage
+  // under a reader, and if an element can be compared while it is overwritten
+  static constexpr bool kOptimisticReads =
+      Table::kStableStorage && std::is_trivially_copyable<T>::value;
+  // Optimistic reads tried before Contains falls back to taking the lock
+  static constexpr size_t kOptimisticAttempts = 4;
+  // Removals counted by one stripe between two checks of the load factor
+  static constexpr size_t kSizeCheckInterval = 32;
+
+  // Current table, owned by the set. With optimistic reads, replaced tables
+  // are retired to |epochs_|, which optimistic readers pin
+  std::atomic<Table *> table_;
+  reclamation::EpochDomain epochs_;
+  // Lock and version counter of every stripe, independent of the capacity
+  std::vector<striping::Stripe<Lock>> stripes_;
+  resizing::LoadFactorPolicy policy_;
+  // The table never shrinks below its initial capacity
+  size_t min_capacity_;
+  stats::ProbeHistogram probes_;
+  stats::ResizeCounters resizes_;
+
+  // returns the the mutex corresponding to the hash,
+  Lock *GetLock(size_t hash) { return &GetStripe(hash).mutex; }
+
+  std::atomic<size_t> &GetVersion(size_t hash) {
+    return GetStripe(hash).version;
+  }
 
-  // Doubles bucket vector and puts elements into new buckets
-  void Resize() {
-    size_t old_size = table_.size();
+  striping::Stripe<Lock> &GetStripe(size_t hash) {
+    return stripes_[hash & (stripes_.size() - 1)];
+  }
 
-    // Locks every mutex in a list of scopedlocks, ensures the set is not
-    // modified during resizing.
-    // These locks are unlocked once resising finishes (assumes no locks are
-    // held)
-    std::vector<std::unique_ptr<std::scoped_lock<std::mutex>>> locks;
-    for (size_t i = 0; i < mutex_ptrs_.size(); i++) {
+  // Takes every stripe lock, in order, until the returned locks are destroyed
+  std::vector<std::unique_ptr<std::scoped_lock<Lock>>> LockAll() {
+    std::vector<std::unique_ptr<std::scoped_lock<Lock>>> locks;
+    for (size_t i = 0; i < stripes_.size(); i++) {
       locks.push_back(
-          std::make_unique<std::scoped_lock<std::mutex>>(*mutex_ptrs_[i]));
+          std::make_unique<std::scoped_lock<Lock>>(stripes_[i].mutex));
     }
+    return locks;
+  }
+
+  // Marks the stripe of |hash| as being modified. Must hold its lock
+  void BeginWrite(size_t hash) {
+    if constexpr (kOptimisticReads) {
+      std::atomic<size_t> &version = GetVersion(hash);
+      version.store(version.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+  }
+
+  // Publishes the modification of the stripe of |hash|. Must hold its lock
+  void EndWrite(size_t hash) {
+    if constexpr (kOptimisticReads) {
+      std::atomic<size_t> &version = GetVersion(hash);
+      version.store(version.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+  }
+
+  // Runs |read| on the current table without locking. Returns false if a
+  // writer was inside the stripe of |hash| at any point, in which case whatever
+  // |read| produced must be discarded. The caller must pin |epochs_|
+  template <typename Read> bool TryRead(size_t hash, Read read) {
+    std::atomic<size_t> &version = GetVersion(hash);
+    size_t before = version.load(std::memory_order_acquire);
+    if ((before & 1) != 0) {
+      return false;
+    }
+    read(*table_.load(std::memory_order_acquire));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == before;
+  }
 
-    if (old_size == table_.size()) {
-      std::vector<std::vector<T>> old_table = table_;
-      table_ = std::vector<std::vector<T>>(old_table.size() * 2);
-      for (auto &bucket : old_table) {
-        for (auto &elem : bucket) {
-          GetBucket(std::hash<T>()(elem)).push_back(elem);
+  // Looks up |key|, an element or a key comparing equal to elements
+  template <typename K> bool ContainsKey(const K &key) {
+    size_t key_hash = Hash()(key);
+    if constexpr (kOptimisticReads) {
+      bool found = false;
+      auto read = [&](const Table &current) {
+        found = current.Contains(key_hash, key);
+      };
+      auto guard = epochs_.Pin();
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryRead(key_hash, read)) {
+          return found;
         }
       }
     }
+    locking::ReadGuard<Lock> readGuard(*GetLock(key_hash));
+    return table_.load()->Contains(key_hash, key);
+  }
+
+  // Inserts elems[order[begin, end)], which all belong to the same stripe,
+  // under one acquisition of that stripe's lock
+  size_t AddGroup(const std::vector<T> &elems,
+                  const std::vector<size_t> &hashes,
+                  const std::vector<size_t> &order, size_t begin, size_t end) {
+    size_t stripe_hash = hashes[order[begin]];
+    std::unique_lock<Lock> uniqueLock(*GetLock(stripe_hash));
+    BeginWrite(stripe_hash);
+    Table *current = table_.load();
+    size_t added = 0;
+    bool grow = false;
+    for (size_t i = begin; i < end; i++) {
+      PrefetchAhead(*current, hashes, order, i, end);
+      size_t hash = hashes[order[i]];
+      // Grows as soon as the policy asks for it rather than after the group,
+      // which may be large enough to need several doublings
+      while (grow || current->Full(hash)) {
+        EndWrite(stripe_hash);
+        size_t capacity = current->Capacity();
+        uniqueLock.unlock();
+        Resize(capacity);
+        uniqueLock.lock();
+        BeginWrite(stripe_hash);
+        current = table_.load();
+        grow = false;
+      }
+      if (current->Insert(hash, elems[order[i]])) {
+        added++;
+        GetStripe(stripe_hash).AddToSize(1);
+        grow = Policy(stripe_hash);
+      }
+    }
+    EndWrite(stripe_hash);
+    if (grow) {
+      size_t capacity = current->Capacity();
+      uniqueLock.unlock();
+      Resize(capacity);
+    }
+    return added;
+  }
+
+  // Removes elems[order[begin, end)] under one acquisition of their lock
+  size_t RemoveGroup(const std::vector<T> &elems,
+                     const std::vector<size_t> &hashes,
+                     const std::vector<size_t> &order, size_t begin,
+                     size_t end) {
+    size_t stripe_hash = hashes[order[begin]];
+    std::unique_lock<Lock> uniqueLock(*GetLock(stripe_hash));
+    BeginWrite(stripe_hash);
+    Table *current = table_.load();
+    size_t removed = 0;
+    for (size_t i = begin; i < end; i++) {
+      PrefetchAhead(*current, hashes, order, i, end);
+      if (current->Erase(hashes[order[i]], elems[order[i]])) {
+        removed++;
+      }
+    }
+    EndWrite(stripe_hash);
+    striping::Stripe<Lock> &stripe = GetStripe(stripe_hash);
+    size_t old_stripe_size = stripe.size.load(std::memory_order_relaxed);
+    stripe.SubtractFromSize(removed);
+    // Checks the load if the stripe count went past a multiple of
+    // kSizeCheckInterval, where single removals would have checked it
+    if ((old_stripe_size - removed) / kSizeCheckInterval !=
+            old_stripe_size / kSizeCheckInterval &&
+        Underloaded()) {
+      uniqueLock.unlock();
+      Shrink();
+    }
+    return removed;
+  }
+
+  // Looks up elems[order[begin, end)], first optimistically and otherwise
+  // under one acquisition of their lock
+  void ContainsGroup(const std::vector<T> &elems,
+                     const std::vector<size_t> &hashes,
+                     const std::vector<size_t> &order, size_t begin,
+                     size_t end, std::vector<bool> *result) {
+    size_t stripe_hash = hashes[order[begin]];
+    auto read = [&](const Table &current) {
+      for (size_t i = begin; i < end; i++) {
+        PrefetchAhead(current, hashes, order, i, end);
+        (*result)[order[i]] =
+            current.Contains(hashes[order[i]], elems[order[i]]);
+      }
+    };
+    if constexpr (kOptimisticReads) {
+      auto guard = epochs_.Pin();
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryRead(stripe_hash, read)) {
+          return;
+        }
+      }
+    }
+    locking::ReadGuard<Lock> readGuard(*GetLock(stripe_hash));
+    read(*table_.load());
+  }
+
+  // Prefetches the bucket of the element batching::kPrefetchDistance after
+  // position |i| of a group ending at |end|
+  static void PrefetchAhead(const Table &current,
+                            const std::vector<size_t> &hashes,
+                            const std::vector<size_t> &order, size_t i,
+                            size_t end) {
+    if (i + batching::kPrefetchDistance < end) {
+      current.Prefetch(hashes[order[i + batching::kPrefetchDistance]]);
+    }
+  }
+
+  // The stripe of |hash|, scaled to the whole table, exceeds the maximum load
+  // of the policy, or the region of this hash cannot take another element.
+  // Only the count of the stripe, whose lock the caller holds, is read
+  bool Policy(size_t hash) {
+    Table *table = table_.load();
+    size_t stripe_size = GetStripe(hash).size.load(std::memory_order_relaxed);
+    return policy_.ShouldGrow(stripe_size * stripes_.size(),
+                              table->Capacity()) ||
+           table->Full(hash);
+  }
+
+  // Returns true iff the set fell below the minimum load of the policy after a
+  // removal from the stripe of |hash|. A single stripe is too small a sample
+  // to shrink on, so the stripe counts are summed, without locking, but only
+  // whenever the stripe count reaches a multiple of kSizeCheckInterval. The
+  // caller must hold the lock of the stripe
+  bool ShrinkPolicy(size_t hash) {
+    size_t stripe_size = GetStripe(hash).size.load(std::memory_order_relaxed);
+    return stripe_size % kSizeCheckInterval == 0 && Underloaded();
+  }
+
+  bool Underloaded() {
+    return policy_.ShouldShrink(Size(), table_.load()->Capacity(),
+                                min_capacity_);
+  }
+
+  // Doubles bucket vector and puts elements into new buckets. |old_capacity|
+  // is the capacity the caller saw under its lock, so that a resize that
+  // finished in the meantime is not repeated
+  void Resize(size_t old_capacity) {
+    Rebuild([&](size_t current) {
+      return current == old_capacity ? current * 2 : current;
+    });
+  }
+
+  // Shrinks the table if it is still underloaded once every writer is paused
+  void Shrink() {
+    Rebuild([&](size_t current) {
+      size_t size = Size();
+      if (!policy_.ShouldShrink(size, current, min_capacity_)) {
+        return current;
+      }
+      return policy_.ShrunkCapacity(size, current, min_capacity_);
+    });
+  }
+
+  // The set is walked a stripe at a time
+  [[nodiscard]] size_t NumParts() final { return stripes_.size(); }
+
+  // Copies the region of stripe |part|, optimistically if the engine allows
+  // it and otherwise under the stripe lock
+  void CopyPart(size_t part, size_t /*num_parts*/, std::vector<T> *out) final {
+    size_t begin = out->size();
+    auto read = [&](const Table &current) {
+      out->erase(out->begin() + static_cast<std::ptrdiff_t>(begin),
+                 out->end());
+      current.ForEachInRegion(part,
+                              [&](const T &elem) { out->push_back(elem); });
+    };
+    if constexpr (kOptimisticReads) {
+      auto guard = epochs_.Pin();
+      for (size_t i = 0; i < kOptimisticAttempts; i++) {
+        if (TryRead(part, read)) {
+          return;
+        }
+      }
+    }
+    locking::ReadGuard<Lock> readGuard(stripes_[part].mutex);
+    read(*table_.load());
+  }
+
+  // Rebuilds the table with the capacity |target| picks given the current
+  // one, or leaves it as is if |target| returns the current capacity. Locks
+  // every stripe, which ensures the set is not modified meanwhile, and
+  // unlocks them once done, so no locks may be held by the caller. Large
+  // tables are rebuilt by several threads, a region each, and optimistic
+  // readers keep reading the old table until the new one is complete. The old
+  // table is then retired, and freed here unless a reader is still pinned
+  template <typename Target> void Rebuild(Target target) {
+    stats::ResizeScope resize_scope(&resizes_);
+    auto locks = LockAll();
+    resize_scope.Exclusive();
+
+    Table *table = table_.load();
+    size_t capacity = target(table->Capacity());
+    if (capacity == table->Capacity()) {
+      return;
+    }
+    resizing::ParallelFor parallel_for(resizing::RehashWorkers(Size()));
+    if constexpr (kOptimisticReads) {
+      auto rebuilt = std::make_unique<Table>(
+          table->Rehashed(capacity, stripes_.size(), parallel_for));
+      for (size_t i = 0; i < stripes_.size(); i++) {
+        BeginWrite(i);
+      }
+      table_ = rebuilt.release();
+      for (size_t i = 0; i < stripes_.size(); i++) {
+        EndWrite(i);
+      }
+      epochs_.Retire(table);
+      locks.clear();
+      epochs_.Collect();
+    } else {
+      table->Rehash(capacity, stripes_.size(), parallel_for);
+    }
   }
 };
 
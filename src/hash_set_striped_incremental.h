@@ -0,0 +1,299 @@
+#ifndef HASH_SET_STRIPED_INCREMENTAL_H
+#define HASH_SET_STRIPED_INCREMENTAL_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "src/hash_set_base.h"
+#include "src/hashing.h"
+#include "src/stats.h"
+#include "src/striping.h"
+
+// Lock-striped hash set whose resize never stops the world. Growing only takes
+// every lock long enough to swap in an empty table twice the size; buckets are
+// then moved across lazily by the threads using the set. Any operation first
+// helps migrate a small slice of the old table, and migrates the bucket it is
+// about to touch, so no single call ever rehashes more than a bounded number of
+// buckets. Until the migration finishes, lookups consult the old bucket for any
+// element whose bucket has not been moved yet. Bucket and stripe counts are
+// powers of two, and the table never has fewer buckets than stripes.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>>
+class HashSetStripedIncremental : public HashSetBase<T> {
+public:
+  // |num_stripes| is rounded up to a power of two
+  explicit HashSetStripedIncremental(
+      size_t initial_capacity,
+      size_t num_stripes = striping::DefaultStripeCount())
+      : stripes_(hashing::RoundUpToPowerOfTwo(num_stripes)) {
+    initial_capacity = hashing::RoundUpToPowerOfTwo(initial_capacity);
+    table_ = std::vector<std::vector<T>>(
+        initial_capacity > stripes_.size() ? initial_capacity
+                                           : stripes_.size());
+    resizing_ = false;
+    next_chunk_ = 0;
+    migrated_count_ = 0;
+  }
+
+  // Finds the bucket corresponding to the elems hash and inserts the element to
+  // that bucket. Unique lock is needed here to unlock before the call to
+  // StartResize()
+  bool Add(T elem) final {
+    HelpResize();
+    size_t elem_hash = Hash()(elem);
+    std::unique_lock<stats::Mutex> uniqueLock(*GetLock(elem_hash));
+    bool finished = MigrateBucketOf(elem_hash);
+    std::vector<T> &bucket = GetBucket(elem_hash);
+    if (VectorContains(bucket, elem)) {
+      uniqueLock.unlock();
+      if (finished) {
+        FinishResize();
+      }
+      return false;
+    }
+    bucket.push_back(std::move(elem));
+    striping::Stripe<> &stripe = GetStripe(elem_hash);
+    stripe.AddToSize(1);
+    size_t stripe_size = stripe.size.load(std::memory_order_relaxed);
+    bool grow = stripe_size % kSizeCheckInterval == 0 && Policy();
+    // Read under the lock, as the table is only swapped under every lock
+    size_t table_size = table_.size();
+    uniqueLock.unlock();
+    if (finished) {
+      FinishResize();
+    }
+    if (grow) {
+      StartResize(table_size);
+    }
+    return true;
+  }
+
+  // Finds the bucket corresponding to the elems hash and removes the element
+  // from that bucket
+  bool Remove(const T &elem) final {
+    HelpResize();
+    size_t elem_hash = Hash()(elem);
+    bool finished = false;
+    bool removed = false;
+    {
+      std::scoped_lock<stats::Mutex> scopedLock(*GetLock(elem_hash));
+      finished = MigrateBucketOf(elem_hash);
+      std::vector<T> &bucket = GetBucket(elem_hash);
+      for (auto it = bucket.begin(); it != bucket.end(); it++) {
+        if (KeyEqual()(*it, elem)) {
+          bucket.erase(it);
+          GetStripe(elem_hash).SubtractFromSize(1);
+          removed = true;
+          break;
+        }
+      }
+    }
+    if (finished) {
+      FinishResize();
+    }
+    return removed;
+  }
+
+  // Returns true if the element is contained in the HashSet and false
+  // otherwise. Looks in the old table if the bucket has not been migrated yet
+  [[nodiscard]] bool Contains(const T &elem) final {
+    HelpResize();
+    size_t elem_hash = Hash()(elem);
+    std::scoped_lock<stats::Mutex> scopedLock(*GetLock(elem_hash));
+    if (resizing_) {
+      size_t old_index = elem_hash & (old_table_.size() - 1);
+      if (migrated_[old_index] == 0) {
+        return VectorContains(old_table_[old_index], elem);
+      }
+    }
+    return VectorContains(GetBucket(elem_hash), elem);
+  }
+
+  // Returns total size of HashSet, summing the stripe counts without locking,
+  // so it may miss concurrent updates
+  [[nodiscard]] size_t Size() const final {
+    size_t size = 0;
+    for (const auto &stripe : stripes_) {
+      size += stripe.size.load(std::memory_order_relaxed);
+    }
+    return size;
+  }
+
+  // Sums the element counts of the stripes while holding every stripe lock
+  [[nodiscard]] size_t SizeExact() final {
+    auto locks = LockAll();
+    return Size();
+  }
+
+  // Returns the counts of every stripe lock. Empty unless built with
+  // HASH_SET_STATS
+  [[nodiscard]] stats::Snapshot Stats() const final {
+    stats::Snapshot snapshot;
+    if constexpr (stats::kEnabled) {
+      for (const auto &stripe : stripes_) {
+        snapshot.locks.push_back(stats::CountsOf(stripe.mutex));
+      }
+    }
+    return snapshot;
+  }
+
+private:
+  // The set is walked a stripe at a time
+  [[nodiscard]] size_t NumParts() final { return stripes_.size(); }
+
+  // Copies the buckets guarded by stripe |part|: those of the new table, and
+  // those of the old table still waiting to be migrated
+  void CopyPart(size_t part, size_t /*num_parts*/,
+                std::vector<T> *out) final {
+    std::scoped_lock<stats::Mutex> scopedLock(stripes_[part].mutex);
+    for (size_t i = part; i < table_.size(); i += stripes_.size()) {
+      out->insert(out->end(), table_[i].begin(), table_[i].end());
+    }
+    if (resizing_) {
+      for (size_t i = part; i < old_table_.size(); i += stripes_.size()) {
+        if (migrated_[i] == 0) {
+          out->insert(out->end(), old_table_[i].begin(), old_table_[i].end());
+        }
+      }
+    }
+  }
+
+  // Number of old buckets a thread migrates each time it helps a resize
+  static constexpr size_t kResizeChunk = 8;
+  // Insertions counted by one stripe between two checks of the load factor
+  static constexpr size_t kSizeCheckInterval = 32;
+
+  std::vector<std::vector<T>> table_;
+  // Table being drained into |table_| while a resize is in progress
+  std::vector<std::vector<T>> old_table_;
+  // Per old bucket flag set once that bucket has been moved to |table_|
+  std::vector<uint8_t> migrated_;
+  // Only changes while every lock is held, so it can be read under any lock
+  std::atomic<bool> resizing_;
+  // Start of the next slice of the old table to be claimed by a helper
+  std::atomic<size_t> next_chunk_;
+  std::atomic<size_t> migrated_count_;
+  // Lock and element count of every stripe, independent of the capacity
+  std::vector<striping::Stripe<>> stripes_;
+
+  // Helper to Contains returning true iff an element is contained in a bucket
+  bool VectorContains(std::vector<T> &v, const T &elem) {
+    for (auto it = v.begin(); it != v.end(); it++) {
+      if (KeyEqual()(*it, elem)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<T> &GetBucket(size_t hash) {
+    return table_[hash & (table_.size() - 1)];
+  }
+
+  // Returns the stripe of |hash|. As both table sizes are multiples of the
+  // number of stripes, old bucket i and its two new buckets, and so their
+  // elements, all belong to the stripe returned for i
+  striping::Stripe<> &GetStripe(size_t hash) {
+    return stripes_[hash & (stripes_.size() - 1)];
+  }
+
+  stats::Mutex *GetLock(size_t hash) { return &GetStripe(hash).mutex; }
+
+  // Takes every stripe lock, in order, until the returned locks are destroyed
+  std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> LockAll() {
+    std::vector<std::unique_ptr<std::scoped_lock<stats::Mutex>>> locks;
+    for (auto &stripe : stripes_) {
+      locks.push_back(
+          std::make_unique<std::scoped_lock<stats::Mutex>>(stripe.mutex));
+    }
+    return locks;
+  }
+
+  // At least one element per bucket. No new resize is started until the
+  // previous one has been fully migrated. Must hold a stripe lock
+  bool Policy() { return !resizing_ && Size() / table_.size(); }
+
+  // Moves old bucket |old_index| into the new table. Must be called with the
+  // lock for |old_index| held. Returns true iff this was the last bucket left
+  // to migrate, in which case the caller must call FinishResize() once it has
+  // released its lock
+  bool MigrateBucket(size_t old_index) {
+    if (!resizing_ || old_index >= old_table_.size() ||
+        migrated_[old_index] != 0) {
+      return false;
+    }
+    for (auto &elem : old_table_[old_index]) {
+      GetBucket(Hash()(elem)).push_back(std::move(elem));
+    }
+    std::vector<T>().swap(old_table_[old_index]);
+    migrated_[old_index] = 1;
+    return migrated_count_.fetch_add(1) + 1 == old_table_.size();
+  }
+
+  // Migrates the old bucket that |hash| belonged to, if there is a resize in
+  // progress. Same locking contract as MigrateBucket()
+  bool MigrateBucketOf(size_t hash) {
+    if (!resizing_) {
+      return false;
+    }
+    return MigrateBucket(hash & (old_table_.size() - 1));
+  }
+
+  // Claims the next slice of the old table and migrates it, one bucket at a
+  // time under that bucket's lock. Must be called without holding any locks
+  void HelpResize() {
+    if (!resizing_) {
+      return;
+    }
+    size_t begin = next_chunk_.fetch_add(kResizeChunk);
+    bool finished = false;
+    for (size_t i = begin; i < begin + kResizeChunk; i++) {
+      std::scoped_lock<stats::Mutex> scopedLock(*GetLock(i));
+      if (!resizing_ || i >= old_table_.size()) {
+        break;
+      }
+      finished = MigrateBucket(i) || finished;
+    }
+    if (finished) {
+      FinishResize();
+    }
+  }
+
+  // Installs an empty table twice the size and leaves the old one to be
+  // migrated incrementally. |old_size| is the table size the caller saw under
+  // its lock, so that a resize that started in the meantime is not repeated.
+  // Assumes no locks are held
+  void StartResize(size_t old_size) {
+    // No thread is inside a bucket while the tables are swapped
+    auto locks = LockAll();
+
+    if (!resizing_ && old_size == table_.size()) {
+      old_table_ = std::move(table_);
+      table_ = std::vector<std::vector<T>>(old_size * 2);
+      migrated_.assign(old_size, 0);
+      migrated_count_ = 0;
+      next_chunk_ = 0;
+      resizing_ = true;
+    }
+  }
+
+  // Drops the drained old table once every bucket has been migrated. Assumes
+  // no locks are held
+  void FinishResize() {
+    auto locks = LockAll();
+
+    if (resizing_ && migrated_count_ == old_table_.size()) {
+      old_table_ = std::vector<std::vector<T>>();
+      migrated_ = std::vector<uint8_t>();
+      resizing_ = false;
+    }
+  }
+};
+
+#endif // HASH_SET_STRIPED_INCREMENTAL_H
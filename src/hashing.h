@@ -0,0 +1,77 @@
+#ifndef HASHING_H
+#define HASHING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Hash functors and index arithmetic shared by the hash sets and their storage
+// engines
+namespace hashing {
+
+// Scrambles |value| so that every input bit affects every output bit, using the
+// finalizer of splitmix64
+inline uint64_t Mix64(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xBF58476D1CE4E5B9ULL;
+  value ^= value >> 27;
+  value *= 0x94D049BB133111EBULL;
+  return value ^ (value >> 31);
+}
+
+// Hasher for keys whose std::hash leaves patterns in the low bits, which is all
+// that masking a power-of-two bucket count looks at: std::hash is the identity
+// for integers, so for instance multiples of 1024 would all share one bucket.
+// It is not the default, as the identity keeps runs of consecutive keys in
+// neighbouring buckets, which scrambling would scatter across memory
+template <typename T> struct MixingHash {
+  size_t operator()(const T &elem) const {
+    return static_cast<size_t>(Mix64(std::hash<T>()(elem)));
+  }
+};
+
+// Transparent hasher for std::string elements, which hashes std::string_view
+// and C string keys as their std::string would be hashed. Together with
+// std::equal_to<> it lets a string set look keys up without building a string
+struct StringHash {
+  using is_transparent = void;
+
+  size_t operator()(std::string_view key) const {
+    return std::hash<std::string_view>()(key);
+  }
+};
+
+// True if |Hash| and |KeyEqual| both declare is_transparent and |Hash| accepts
+// a |Key|, in which case sets can look up keys of another type than their
+// elements, as the C++20 unordered containers do
+template <typename Hash, typename KeyEqual, typename Key, typename = void>
+struct IsTransparent : std::false_type {};
+
+template <typename Hash, typename KeyEqual, typename Key>
+struct IsTransparent<
+    Hash, KeyEqual, Key,
+    std::void_t<typename Hash::is_transparent,
+                typename KeyEqual::is_transparent,
+                decltype(std::declval<const Hash &>()(
+                    std::declval<const Key &>()))>> : std::true_type {};
+
+// Returns the smallest power of two that is at least |value|, and 1 for 0
+inline size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+// Returns log2 of |value|, which must be a power of two
+inline size_t Log2(size_t value) {
+  return static_cast<size_t>(__builtin_ctzll(value));
+}
+
+} // namespace hashing
+
+#endif // HASHING_H
@@ -0,0 +1,126 @@
+#ifndef LOCKING_H
+#define LOCKING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "src/striping.h"
+
+// Lock policies of the lock-based hash sets. Any type with lock and unlock
+// will do; types that also have lock_shared and unlock_shared, such as
+// std::shared_mutex or DistributedSharedMutex, let lookups share the lock
+namespace locking {
+
+// True if |Lock| can be held in shared mode
+template <typename Lock, typename = void> struct IsShared : std::false_type {};
+
+template <typename Lock>
+struct IsShared<Lock,
+                std::void_t<decltype(std::declval<Lock &>().lock_shared()),
+                            decltype(std::declval<Lock &>().unlock_shared())>>
+    : std::true_type {};
+
+// Guard that lookups hold: a shared lock if |Lock| supports it, and an
+// exclusive one otherwise
+template <typename Lock>
+using ReadGuard = std::conditional_t<IsShared<Lock>::value,
+                                     std::shared_lock<Lock>,
+                                     std::scoped_lock<Lock>>;
+
+// Reader-writer lock whose readers only touch their own reader indicator, so
+// that concurrent readers on different cores do not bounce a shared count
+// between their caches. Threads are spread over kReaderSlots indicators, each
+// on its own cache line. Writers are serialized by a mutex, announce
+// themselves and wait for every indicator to drain; readers that find a
+// writer announced step back until it is done, so writers are not starved.
+// Fits locks that are mostly taken in shared mode, as a writer has to visit
+// every indicator
+class DistributedSharedMutex {
+public:
+  void lock() {
+    writer_mutex_.lock();
+    writer_.store(true, std::memory_order_seq_cst);
+    for (const auto &slot : slots_) {
+      while (slot.readers.load(std::memory_order_seq_cst) != 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  bool try_lock() {
+    if (!writer_mutex_.try_lock()) {
+      return false;
+    }
+    writer_.store(true, std::memory_order_seq_cst);
+    for (const auto &slot : slots_) {
+      if (slot.readers.load(std::memory_order_seq_cst) != 0) {
+        unlock();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void unlock() {
+    writer_.store(false, std::memory_order_release);
+    writer_mutex_.unlock();
+  }
+
+  void lock_shared() {
+    std::atomic<size_t> &readers = slots_[ThisThreadSlot()].readers;
+    while (true) {
+      readers.fetch_add(1, std::memory_order_seq_cst);
+      if (!writer_.load(std::memory_order_seq_cst)) {
+        return;
+      }
+      readers.fetch_sub(1, std::memory_order_release);
+      while (writer_.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  bool try_lock_shared() {
+    std::atomic<size_t> &readers = slots_[ThisThreadSlot()].readers;
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    if (!writer_.load(std::memory_order_seq_cst)) {
+      return true;
+    }
+    readers.fetch_sub(1, std::memory_order_release);
+    return false;
+  }
+
+  void unlock_shared() {
+    slots_[ThisThreadSlot()].readers.fetch_sub(1, std::memory_order_release);
+  }
+
+private:
+  static constexpr size_t kReaderSlots = 16;
+
+  struct alignas(striping::kCacheLineSize) Slot {
+    std::atomic<size_t> readers{0};
+  };
+
+  std::array<Slot, kReaderSlots> slots_;
+  std::atomic<bool> writer_{false};
+  std::mutex writer_mutex_;
+
+  // Threads take slots in turn as they first lock any DistributedSharedMutex,
+  // which spreads them evenly without asking the OS for the current core
+  static size_t ThisThreadSlot() {
+    static std::atomic<size_t> next_slot{0};
+    thread_local size_t slot =
+        next_slot.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+    return slot;
+  }
+};
+
+} // namespace locking
+
+#endif // LOCKING_H
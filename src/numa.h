@@ -0,0 +1,129 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(HASH_SET_NUMA)
+#include <numa.h>
+#endif
+
+// Where memory and threads live on machines with several NUMA nodes. With
+// libnuma, which the ENABLE_NUMA CMake option links and signals by defining
+// HASH_SET_NUMA, memory is bound to a node by policy. Otherwise placement
+// relies on first touch: memory lands on the node of the thread that first
+// writes it, so it is allocated and filled from a thread running on that
+// node. Without topology information, as on other platforms, the machine is
+// treated as a single node.
+namespace numa {
+
+// Returns the CPUs of |node| as listed by sysfs, or nothing if unknown
+inline std::vector<size_t> CpusOf(size_t node) {
+  std::vector<size_t> cpus;
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+  std::string list;
+  if (!std::getline(file, list)) {
+    return cpus;
+  }
+  // Comma separated CPUs and inclusive ranges, such as 0-3,8-11
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    size_t dash = range.find('-');
+    try {
+      size_t first = std::stoul(range.substr(0, dash));
+      size_t last = dash == std::string::npos
+                        ? first
+                        : std::stoul(range.substr(dash + 1));
+      for (size_t cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::exception &) {
+      return {};
+    }
+  }
+  return cpus;
+}
+
+// Returns the number of NUMA nodes, at least one
+inline size_t NumNodes() {
+#if defined(HASH_SET_NUMA)
+  if (numa_available() >= 0) {
+    int nodes = numa_num_configured_nodes();
+    return nodes > 0 ? static_cast<size_t>(nodes) : 1;
+  }
+#endif
+  size_t nodes = 0;
+  while (std::ifstream("/sys/devices/system/node/node" +
+                       std::to_string(nodes) + "/cpulist")) {
+    nodes++;
+  }
+  return nodes > 0 ? nodes : 1;
+}
+
+// Returns the node the calling thread is running on, which may change unless
+// the thread is pinned, or 0 if unknown
+inline size_t CurrentNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+    return node;
+  }
+#endif
+  return 0;
+}
+
+// Runs |work| on a thread bound to |node|, so that the memory it allocates
+// and first writes is placed there, and returns once it is done. Threads that
+// |work| starts inherit the binding. Runs |work| on the calling thread if the
+// node cannot be bound to
+template <typename Work> void RunOnNode(size_t node, Work work) {
+#if defined(HASH_SET_NUMA)
+  if (numa_available() >= 0) {
+    std::thread thread([&] {
+      numa_run_on_node(static_cast<int>(node));
+      numa_set_preferred(static_cast<int>(node));
+      work();
+    });
+    thread.join();
+    return;
+  }
+#endif
+#if defined(__linux__)
+  std::vector<size_t> cpus = CpusOf(node);
+  if (!cpus.empty()) {
+    std::thread thread([&] {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (size_t cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+          CPU_SET(cpu, &set);
+        }
+      }
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      work();
+    });
+    thread.join();
+    return;
+  }
+#endif
+  work();
+}
+
+} // namespace numa
+
+#endif // NUMA_H
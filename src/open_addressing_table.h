@@ -0,0 +1,330 @@
+#ifndef OPEN_ADDRESSING_TABLE_H
+#define OPEN_ADDRESSING_TABLE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/hashing.h"
+#include "src/resizing.h"
+#include "src/stats.h"
+
+// Bucket storage using linear probing over a single contiguous array of slots,
+// with backward-shift deletion so that no tombstones are ever left behind.
+//
+// The slots are split into |num_regions| equally sized, contiguous regions, and
+// an element with hash h only ever probes inside region h % num_regions. Lock
+// striped sets pass their number of locks as |num_regions|, so each lock owns
+// exactly one region. Regions hold a power of two of slots. See ChainedTable
+// for the storage engine interface. The slots are a single allocation, so
+// |Allocator| is used as is, without per-region pools.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Allocator = std::allocator<T>>
+class OpenAddressingTable {
+public:
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+
+  explicit OpenAddressingTable(size_t capacity, size_t num_regions = 1) {
+    num_regions_ = hashing::RoundUpToPowerOfTwo(num_regions);
+    region_shift_ = hashing::Log2(num_regions_);
+    region_capacity_ = hashing::RoundUpToPowerOfTwo(capacity / num_regions_);
+    slots_ = Slots(region_capacity_ * num_regions_);
+    region_sizes_ = std::vector<size_t>(num_regions_, 0);
+  }
+
+  // Returns the number of slots
+  [[nodiscard]] size_t Capacity() const { return slots_.size(); }
+
+  // Returns true iff an element equal to |key|, whose hash is |hash|, is in
+  // the table
+  template <typename K>
+  [[nodiscard]] bool Contains(size_t hash, const K &key) const {
+    return Find(hash, key) != kNotFound;
+  }
+
+  // Stores |elem| in the first free slot of its probe sequence. Returns false
+  // if it was already present. Callers check that the region of |hash| is not
+  // Full() first; only Grown goes past that, when splitting a region sends
+  // most of its elements to the same half
+  bool Insert(size_t hash, const T &elem) { return InsertImpl(hash, elem); }
+
+  // Moves |elem| into the table, unless it was already present
+  bool Insert(size_t hash, T &&elem) {
+    return InsertImpl(hash, std::move(elem));
+  }
+
+  // Removes |elem|, shifting back later elements of the probe sequence that
+  // would otherwise become unreachable. Returns false if it was absent
+  bool Erase(size_t hash, const T &elem) {
+    size_t index = Find(hash, elem);
+    if (index == kNotFound) {
+      return false;
+    }
+    size_t base = RegionBase(hash);
+    size_t hole = index - base;
+    size_t offset = hole;
+    for (size_t probes = 1; probes < region_capacity_; probes++) {
+      offset = Next(offset);
+      Slot &slot = slots_[base + offset];
+      if (!slot.occupied) {
+        break;
+      }
+      // The element may only move into the hole if its home slot does not
+      // lie cyclically in (hole, offset]
+      size_t home = Home(Hash()(slot.elem));
+      bool must_stay = hole <= offset ? (hole < home && home <= offset)
+                                      : (hole < home || home <= offset);
+      if (!must_stay) {
+        slots_[base + hole] = std::move(slot);
+        hole = offset;
+      }
+    }
+    slots_[base + hole].occupied = false;
+    region_sizes_[Region(hash)]--;
+    return true;
+  }
+
+  // Hints the processor to start loading the home slot of |hash|
+  void Prefetch(size_t hash) const {
+    __builtin_prefetch(&slots_[RegionBase(hash) + Home(hash)]);
+  }
+
+  // Returns true iff the region of |hash| reached its maximum load of 3/4, so
+  // that the table must grow before another element can be inserted there
+  [[nodiscard]] bool Full(size_t hash) const {
+    return region_sizes_[Region(hash)] >=
+           region_capacity_ - region_capacity_ / 4;
+  }
+
+  // Calls |visit| on every element
+  template <typename Visit> void ForEach(Visit visit) const {
+    for (const auto &slot : slots_) {
+      if (slot.occupied) {
+        visit(slot.elem);
+      }
+    }
+  }
+
+  // Calls |visit| on every element of |region|
+  template <typename Visit>
+  void ForEachInRegion(size_t region, Visit visit) const {
+    size_t base = region * region_capacity_;
+    for (size_t i = base; i < base + region_capacity_; i++) {
+      if (slots_[i].occupied) {
+        visit(slots_[i].elem);
+      }
+    }
+  }
+
+  // Records the probe length of every lookup in |histogram|, as will the
+  // tables grown from this one
+  void AttachProbes(stats::ProbeHistogram *histogram) {
+    probes_.Attach(histogram);
+  }
+
+  // The slot array is only replaced by Rehash
+  static constexpr bool kStableStorage = true;
+
+  // Regions are Full at 3/4
+  static constexpr double kMaxLoad = 0.75;
+
+  // Doubles every region and moves all elements over
+  void Grow() { Grow(num_regions_); }
+
+  // Doubles the slots, split into |num_regions| regions
+  void Grow(size_t num_regions) { Rehash(slots_.size() * 2, num_regions); }
+
+  // Returns a copy of the table with every region doubled, leaving this one
+  // untouched
+  [[nodiscard]] OpenAddressingTable Grown() const {
+    return Grown(num_regions_);
+  }
+
+  // Returns a copy of the table with twice the slots, split into
+  // |num_regions| regions, for sets whose lock count grows with the table
+  [[nodiscard]] OpenAddressingTable Grown(size_t num_regions) const {
+    return Rehashed(slots_.size() * 2, num_regions);
+  }
+
+  // Rebuilds the table with |capacity| slots split into |num_regions|
+  // regions, and moves all elements over without comparing them, as they are
+  // known to be distinct. When shrinking, regions are kept large enough for
+  // the elements that fall into them not to fill them up
+  template <typename ForEachIndex = resizing::SerialFor>
+  void Rehash(size_t capacity, size_t num_regions,
+              ForEachIndex for_each_index = {}) {
+    OpenAddressingTable rehashed(FitCapacity(capacity, num_regions),
+                                 num_regions);
+    rehashed.probes_ = probes_;
+    ForEachOldRegion(rehashed, for_each_index, [&](size_t region) {
+      size_t base = region * region_capacity_;
+      for (size_t i = base; i < base + region_capacity_; i++) {
+        if (slots_[i].occupied) {
+          rehashed.Place(Hash()(slots_[i].elem), std::move(slots_[i].elem));
+        }
+      }
+    });
+    *this = std::move(rehashed);
+  }
+
+  // Returns a copy of the table rebuilt as Rehash does
+  template <typename ForEachIndex = resizing::SerialFor>
+  [[nodiscard]] OpenAddressingTable
+  Rehashed(size_t capacity, size_t num_regions,
+           ForEachIndex for_each_index = {}) const {
+    OpenAddressingTable rehashed(FitCapacity(capacity, num_regions),
+                                 num_regions);
+    rehashed.probes_ = probes_;
+    ForEachOldRegion(rehashed, for_each_index, [&](size_t region) {
+      size_t base = region * region_capacity_;
+      for (size_t i = base; i < base + region_capacity_; i++) {
+        if (slots_[i].occupied) {
+          rehashed.Place(Hash()(slots_[i].elem), slots_[i].elem);
+        }
+      }
+    });
+    return rehashed;
+  }
+
+private:
+  struct Slot {
+    T elem;
+    bool occupied = false;
+  };
+
+  using Slots = std::vector<
+      Slot, typename std::allocator_traits<Allocator>::template rebind_alloc<
+                Slot>>;
+
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+  size_t num_regions_;
+  // log2(num_regions_)
+  size_t region_shift_;
+  size_t region_capacity_;
+  Slots slots_;
+  // Number of occupied slots in every region
+  std::vector<size_t> region_sizes_;
+  stats::ProbeRecorder probes_;
+
+  size_t Region(size_t hash) const { return hash & (num_regions_ - 1); }
+
+  // Returns |capacity|, or the smallest larger capacity whose regions, split
+  // |num_regions| ways, would still not be Full once the elements are placed
+  size_t FitCapacity(size_t capacity, size_t num_regions) const {
+    if (capacity >= slots_.size()) {
+      return capacity;
+    }
+    num_regions = hashing::RoundUpToPowerOfTwo(num_regions);
+    std::vector<size_t> sizes(num_regions, 0);
+    for (const auto &slot : slots_) {
+      if (slot.occupied) {
+        sizes[Hash()(slot.elem) & (num_regions - 1)]++;
+      }
+    }
+    size_t largest = *std::max_element(sizes.begin(), sizes.end());
+    size_t region_capacity =
+        hashing::RoundUpToPowerOfTwo(capacity / num_regions);
+    while (largest >= region_capacity - region_capacity / 4) {
+      region_capacity *= 2;
+    }
+    return std::max(capacity, region_capacity * num_regions);
+  }
+
+  size_t RegionBase(size_t hash) const {
+    return Region(hash) * region_capacity_;
+  }
+
+  // Runs |work| on every region of this table through |for_each_index|, or
+  // serially if |rehashed| has fewer regions. See ChainedTable
+  template <typename ForEachIndex, typename Work>
+  void ForEachOldRegion(const OpenAddressingTable &rehashed,
+                        ForEachIndex for_each_index, Work work) const {
+    if (rehashed.num_regions_ >= num_regions_) {
+      for_each_index(num_regions_, work);
+    } else {
+      resizing::SerialFor()(num_regions_, work);
+    }
+  }
+
+  // Offset of the home slot of |hash| within its region. The bits left over
+  // once the region is picked are scrambled again, so that a weak |Hash| such
+  // as std::hash does not merge runs of consecutive keys into long probe
+  // sequences
+  size_t Home(size_t hash) const {
+    uint64_t mixed =
+        static_cast<uint64_t>(hash >> region_shift_) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(mixed ^ (mixed >> 32)) & (region_capacity_ - 1);
+  }
+
+  size_t Next(size_t offset) const {
+    return (offset + 1) & (region_capacity_ - 1);
+  }
+
+  template <typename U> bool InsertImpl(size_t hash, U &&elem) {
+    size_t base = RegionBase(hash);
+    size_t offset = Home(hash);
+    for (size_t probes = 0; probes < region_capacity_; probes++) {
+      Slot &slot = slots_[base + offset];
+      if (!slot.occupied) {
+        slot.elem = std::forward<U>(elem);
+        slot.occupied = true;
+        region_sizes_[Region(hash)]++;
+        return true;
+      }
+      if (KeyEqual()(slot.elem, elem)) {
+        return false;
+      }
+      offset = Next(offset);
+    }
+    assert(false && "Insert into a full region");
+    return false;
+  }
+
+  // Stores |elem|, which is not in the table, in the first free slot of its
+  // probe sequence, as Insert does but without comparing elements
+  template <typename U> void Place(size_t hash, U &&elem) {
+    size_t base = RegionBase(hash);
+    size_t offset = Home(hash);
+    for (size_t probes = 0; probes < region_capacity_; probes++) {
+      Slot &slot = slots_[base + offset];
+      if (!slot.occupied) {
+        slot.elem = std::forward<U>(elem);
+        slot.occupied = true;
+        region_sizes_[Region(hash)]++;
+        return;
+      }
+      offset = Next(offset);
+    }
+    assert(false && "Insert into a full region");
+  }
+
+  // Returns the index of the slot holding an element equal to |key|, or
+  // kNotFound
+  template <typename K> size_t Find(size_t hash, const K &key) const {
+    size_t base = RegionBase(hash);
+    size_t offset = Home(hash);
+    for (size_t probes = 0; probes < region_capacity_; probes++) {
+      const Slot &slot = slots_[base + offset];
+      if (!slot.occupied) {
+        probes_.Record(probes + 1);
+        return kNotFound;
+      }
+      if (KeyEqual()(slot.elem, key)) {
+        probes_.Record(probes + 1);
+        return base + offset;
+      }
+      offset = Next(offset);
+    }
+    probes_.Record(region_capacity_);
+    return kNotFound;
+  }
+};
+
+#endif // OPEN_ADDRESSING_TABLE_H
@@ -0,0 +1,205 @@
+#ifndef RECLAMATION_H
+#define RECLAMATION_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src/hashing.h"
+#include "src/striping.h"
+
+// When memory that readers reach without locking may be released
+namespace reclamation {
+
+// Epoch based reclamation (Fraser). Threads pin the domain before reading
+// shared objects without a lock and unpin it once they no longer hold any
+// pointer to them. An object unlinked from every shared structure is handed
+// to Retire rather than deleted, and is deleted once every thread that was
+// pinned when it was retired has unpinned.
+//
+// The domain counts time in epochs. A pin is counted under the epoch it
+// started in, and the epoch only advances once no pin is left from the
+// previous one, so pins span at most two consecutive epochs. An object
+// retired in epoch e can therefore no longer be reached once the epoch
+// reaches e + 2. Pins are counted in slots picked by thread id, as the cells
+// of ShardedCounter are, so threads sharing a slot only share its counters,
+// and pinning never waits. Every slot also keeps the objects its threads
+// retired, under its own lock.
+class EpochDomain {
+public:
+  // Keeps the domain pinned by the calling thread until destroyed. Guards
+  // nest, and may be destroyed on another thread than the one pinning
+  class Guard {
+  public:
+    Guard(Guard &&other) noexcept
+        : pins_(std::exchange(other.pins_, nullptr)) {}
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+    Guard &operator=(Guard &&) = delete;
+
+    ~Guard() {
+      if (pins_ != nullptr) {
+        pins_->fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+  private:
+    friend class EpochDomain;
+
+    explicit Guard(std::atomic<size_t> *pins) : pins_(pins) {}
+
+    // Pin counter of the epoch the guard started in
+    std::atomic<size_t> *pins_;
+  };
+
+  EpochDomain() {
+    size_t threads = std::thread::hardware_concurrency();
+    slots_ = std::vector<Slot>(hashing::RoundUpToPowerOfTwo(threads));
+  }
+
+  EpochDomain(const EpochDomain &) = delete;
+  EpochDomain &operator=(const EpochDomain &) = delete;
+
+  // Deletes every retired object. No thread may still be pinned
+  ~EpochDomain() {
+    for (auto &slot : slots_) {
+      for (auto &retired : slot.retired) {
+        retired.deleter(retired.object);
+      }
+    }
+  }
+
+  // Pins the domain until the returned guard is destroyed
+  [[nodiscard]] Guard Pin() {
+    Slot &slot = OwnSlot();
+    while (true) {
+      size_t epoch = epoch_.load();
+      std::atomic<size_t> &pins = slot.pins[epoch % kNumEpochs];
+      pins.fetch_add(1);
+      // An advance that scanned the counters before the increment does not
+      // know about this pin, so the pin must start over in the new epoch
+      if (epoch_.load() == epoch) {
+        return Guard(&pins);
+      }
+      pins.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  // Deletes |object|, already unlinked from every shared structure, once no
+  // thread can still be reading it. Every kCollectInterval retirements of a
+  // slot, collects what that slot retired
+  template <typename U> void Retire(U *object) {
+    Slot &slot = OwnSlot();
+    bool collect = false;
+    {
+      std::scoped_lock<std::mutex> scopedLock(slot.mutex);
+      slot.retired.push_back({object, &Delete<U>, epoch_.load()});
+      collect = slot.retired.size() % kCollectInterval == 0;
+    }
+    if (collect) {
+      (void)TryAdvance();
+      CollectSlot(slot);
+    }
+  }
+
+  template <typename U> void Retire(std::unique_ptr<U> object) {
+    Retire(object.release());
+  }
+
+  // Advances the epoch as far as the pinned threads allow, up to twice, and
+  // deletes every retired object no thread can still be reading. With no
+  // thread pinned, that is every retired object
+  void Collect() {
+    for (size_t i = 0; i < 2 && TryAdvance(); i++) {
+    }
+    for (auto &slot : slots_) {
+      CollectSlot(slot);
+    }
+  }
+
+  // Returns the number of retired objects not deleted yet
+  [[nodiscard]] size_t Pending() {
+    size_t pending = 0;
+    for (auto &slot : slots_) {
+      std::scoped_lock<std::mutex> scopedLock(slot.mutex);
+      pending += slot.retired.size();
+    }
+    return pending;
+  }
+
+private:
+  // Pins span the current epoch and the previous one, and objects wait for
+  // two advances, so counters are only needed for three epochs at a time
+  static constexpr size_t kNumEpochs = 3;
+  // Retirements into one slot between two collections
+  static constexpr size_t kCollectInterval = 64;
+
+  struct Retired {
+    void *object;
+    void (*deleter)(void *);
+    // Epoch in which the object was retired
+    size_t epoch;
+  };
+
+  struct alignas(striping::kCacheLineSize) Slot {
+    // Pins still held, counted by epoch modulo kNumEpochs
+    std::array<std::atomic<size_t>, kNumEpochs> pins{};
+    std::mutex mutex;
+    std::vector<Retired> retired;
+  };
+
+  std::atomic<size_t> epoch_{0};
+  std::vector<Slot> slots_;
+
+  template <typename U> static void Delete(void *object) {
+    delete static_cast<U *>(object);
+  }
+
+  Slot &OwnSlot() { return slots_[striping::ThreadIndex(slots_.size())]; }
+
+  // Moves to the next epoch unless a pin from the previous one is still
+  // held. Returns true iff the epoch advanced, here or on another thread
+  bool TryAdvance() {
+    size_t epoch = epoch_.load();
+    size_t previous = (epoch + kNumEpochs - 1) % kNumEpochs;
+    for (const auto &slot : slots_) {
+      if (slot.pins[previous].load() != 0) {
+        return false;
+      }
+    }
+    // Only an advance elsewhere makes the exchange fail
+    (void)epoch_.compare_exchange_strong(epoch, epoch + 1);
+    return true;
+  }
+
+  // Deletes the objects of |slot| retired at least two epochs ago, outside
+  // of its lock
+  void CollectSlot(Slot &slot) {
+    size_t epoch = epoch_.load();
+    std::vector<Retired> expired;
+    {
+      std::scoped_lock<std::mutex> scopedLock(slot.mutex);
+      auto it = slot.retired.begin();
+      for (auto &retired : slot.retired) {
+        if (retired.epoch + 2 <= epoch) {
+          expired.push_back(retired);
+        } else {
+          *it++ = retired;
+        }
+      }
+      slot.retired.erase(it, slot.retired.end());
+    }
+    for (auto &retired : expired) {
+      retired.deleter(retired.object);
+    }
+  }
+};
+
+} // namespace reclamation
+
+#endif // RECLAMATION_H
@@ -0,0 +1,125 @@
+#ifndef RESIZING_H
+#define RESIZING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// When the hash sets grow and shrink their tables
+namespace resizing {
+
+// Bounds on the load of a table, in elements per unit of its capacity: per
+// bucket with ChainedTable, per slot with the open addressing engines. The
+// table doubles once the load exceeds |max_load| and shrinks once it drops
+// below |min_load|, which returns the memory of a purged set; 0 never shrinks.
+//
+// A grown table sits at max_load / 2, and a shrunk one at most there too, so
+// |min_load| must stay below max_load / 2 for neither to flip right back. The
+// further below, the more the size has to swing before the table is rebuilt
+// again.
+struct LoadFactorPolicy {
+  double max_load = 1;
+  double min_load = 0.125;
+
+  // Returns the policy with both bounds scaled down by the same factor, so
+  // that |max_load| does not exceed |engine_max_load|, the load at which the
+  // engine of a set reports itself Full
+  [[nodiscard]] LoadFactorPolicy For(double engine_max_load) const {
+    assert(min_load * 2 < max_load && "min_load must be below max_load / 2");
+    if (max_load <= engine_max_load) {
+      return *this;
+    }
+    return {engine_max_load, min_load * engine_max_load / max_load};
+  }
+
+  // Returns true iff |size| elements overload |capacity|
+  [[nodiscard]] bool ShouldGrow(size_t size, size_t capacity) const {
+    return static_cast<double>(size) > max_load * static_cast<double>(capacity);
+  }
+
+  // Returns true iff |size| elements underload |capacity|, and it is larger
+  // than |min_capacity|
+  [[nodiscard]] bool ShouldShrink(size_t size, size_t capacity,
+                                  size_t min_capacity) const {
+    return capacity > min_capacity &&
+           static_cast<double>(size) < min_load * static_cast<double>(capacity);
+  }
+
+  // Returns the capacity an underloaded table shrinks to: half of |capacity|,
+  // halved again while that keeps the load at most max_load / 2, but no less
+  // than |min_capacity|
+  [[nodiscard]] size_t ShrunkCapacity(size_t size, size_t capacity,
+                                      size_t min_capacity) const {
+    capacity /= 2;
+    while (capacity / 2 >= min_capacity &&
+           static_cast<double>(size) <=
+               max_load / 2 * static_cast<double>(capacity / 2)) {
+      capacity /= 2;
+    }
+    return std::max(capacity, min_capacity);
+  }
+
+  // Returns the smallest capacity that holds |size| elements without growing,
+  // and no less than |min_capacity|
+  [[nodiscard]] size_t CapacityFor(size_t size, size_t min_capacity) const {
+    auto capacity =
+        static_cast<size_t>(static_cast<double>(size) / max_load) + 1;
+    return std::max(capacity, min_capacity);
+  }
+};
+
+// Elements a rebuild must move per thread before another thread is worth
+// starting, which costs tens of microseconds
+constexpr size_t kElementsPerRehashWorker = size_t{1} << 16;
+
+// Runs |work| on every index in [0, |count|), in order, on the calling thread
+struct SerialFor {
+  template <typename Work> void operator()(size_t count, Work work) const {
+    for (size_t i = 0; i < count; i++) {
+      work(i);
+    }
+  }
+};
+
+// Runs |work| on every index in [0, |count|) with up to |num_workers|
+// threads, the calling thread among them, and returns once all are done.
+// Indices are claimed one at a time, so that uneven ones balance out. The
+// helper threads only live for the call, as rebuilds are rare
+class ParallelFor {
+public:
+  explicit ParallelFor(size_t num_workers) : num_workers_(num_workers) {}
+
+  template <typename Work> void operator()(size_t count, Work work) const {
+    std::atomic<size_t> next{0};
+    auto drain = [&] {
+      for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+        work(i);
+      }
+    };
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < std::min(num_workers_, count); i++) {
+      helpers.emplace_back(drain);
+    }
+    drain();
+    for (auto &helper : helpers) {
+      helper.join();
+    }
+  }
+
+private:
+  size_t num_workers_;
+};
+
+// Returns the number of threads worth rebuilding a table of |size| elements
+// with: one per kElementsPerRehashWorker, up to the hardware threads
+inline size_t RehashWorkers(size_t size) {
+  size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  return std::clamp<size_t>(size / kElementsPerRehashWorker, 1, threads);
+}
+
+} // namespace resizing
+
+#endif // RESIZING_H
@@ -0,0 +1,57 @@
+#ifndef SHARDED_COUNTER_H
+#define SHARDED_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "src/hashing.h"
+#include "src/striping.h"
+
+// Counter spread over cells on separate cache lines, in the style of Java's
+// LongAdder. Every thread updates the cell picked by its id, so threads rarely
+// write to the same line, and reading the counter sums all the cells. A cell on
+// its own may wrap below zero when a thread takes away what others added; the
+// sum is still exact once no update is in flight.
+class ShardedCounter {
+public:
+  ShardedCounter() {
+    size_t threads = std::thread::hardware_concurrency();
+    cells_ = std::vector<PaddedCell>(hashing::RoundUpToPowerOfTwo(threads));
+  }
+
+  // Adds one to the cell of the calling thread and returns the new value of
+  // that cell
+  size_t Increment() {
+    return Cell().fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  // Subtracts one from the cell of the calling thread and returns the new
+  // value of that cell, which may have wrapped below zero
+  size_t Decrement() {
+    return Cell().fetch_sub(1, std::memory_order_relaxed) - 1;
+  }
+
+  // Returns the sum of every cell, which may miss updates made concurrently
+  [[nodiscard]] size_t Sum() const {
+    size_t sum = 0;
+    for (const auto &cell : cells_) {
+      sum += cell.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+private:
+  struct alignas(striping::kCacheLineSize) PaddedCell {
+    std::atomic<size_t> value{0};
+  };
+
+  std::vector<PaddedCell> cells_;
+
+  std::atomic<size_t> &Cell() {
+    return cells_[striping::ThreadIndex(cells_.size())].value;
+  }
+};
+
+#endif // SHARDED_COUNTER_H
@@ -0,0 +1,314 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+template <typename T> class HashSetBase;
+
+// Files holding the elements of a hash set, for sets that are rebuilt after a
+// restart. A snapshot is a header followed by the elements, each encoded by
+// snapshot::Codec:
+//
+//   magic      8 bytes  "HSETSNAP"
+//   version    uint32   kVersion
+//   byte order uint32   kByteOrder, as written by the saving machine
+//   elem size  uint64   size of every record, or 0 if records vary in size
+//   count      uint64   number of elements
+//
+// padded with zeros to kDataOffset bytes. Integers and fixed-size records are
+// stored in the byte order of the saving machine, which loading checks.
+//
+// Loading reserves room for every element from the header before adding any,
+// so the set never grows along the way, and adds them kBatchSize at a time
+// through AddAll, which takes every lock once per batch. Fixed-size records
+// are read straight out of a memory mapping of the file where the platform
+// has one; others are streamed. Elements are hashed as they are added, as the
+// hash of an element may differ between builds.
+namespace snapshot {
+
+constexpr char kMagic[8] = {'H', 'S', 'E', 'T', 'S', 'N', 'A', 'P'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kByteOrder = 0x01020304;
+// Records start on this offset, so that mapped records are aligned for any T
+constexpr size_t kDataOffset = 64;
+// Elements handed to AddAll at a time while loading
+constexpr size_t kBatchSize = size_t{1} << 16;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t elem_size;
+  uint64_t count;
+};
+
+// How elements of |T| are stored. Trivially copyable types are stored as
+// their bytes and std::string as its length followed by its characters; other
+// types need a specialization with the same members. Read takes the number of
+// bytes left in the file, lowers it by the bytes it reads, and returns false
+// without reading past them if the record does not fit
+template <typename T, typename = void> struct Codec {
+  static constexpr bool kSupported = false;
+};
+
+template <typename T>
+struct Codec<T, std::enable_if_t<std::is_trivially_copyable<T>::value>> {
+  static constexpr bool kSupported = true;
+  // Size of every record, or 0 if records vary in size
+  static constexpr size_t kSize = sizeof(T);
+
+  static void Write(std::ostream &out, const T &elem) {
+    out.write(reinterpret_cast<const char *>(&elem), sizeof(T));
+  }
+
+  static bool Read(std::istream &in, uint64_t *remaining, T *elem) {
+    if (*remaining < sizeof(T) ||
+        !in.read(reinterpret_cast<char *>(elem), sizeof(T))) {
+      return false;
+    }
+    *remaining -= sizeof(T);
+    return true;
+  }
+};
+
+template <> struct Codec<std::string> {
+  static constexpr bool kSupported = true;
+  static constexpr size_t kSize = 0;
+
+  static void Write(std::ostream &out, const std::string &elem) {
+    auto length = static_cast<uint64_t>(elem.size());
+    out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.write(elem.data(), static_cast<std::streamsize>(elem.size()));
+  }
+
+  static bool Read(std::istream &in, uint64_t *remaining, std::string *elem) {
+    uint64_t length = 0;
+    if (*remaining < sizeof(length) ||
+        !in.read(reinterpret_cast<char *>(&length), sizeof(length))) {
+      return false;
+    }
+    *remaining -= sizeof(length);
+    // Checked before allocating, as a corrupt length may be anything
+    if (length > *remaining) {
+      return false;
+    }
+    elem->resize(static_cast<size_t>(length));
+    if (!in.read(elem->data(), static_cast<std::streamsize>(length))) {
+      return false;
+    }
+    *remaining -= length;
+    return true;
+  }
+};
+
+// Writes every element of |set| to a new file at |path|
+template <typename T, typename Set>
+bool WriteFile(Set &set, const std::string &path) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+  // The count is only known once the walk is over, so the header is written
+  // last
+  out.seekp(kDataOffset);
+  uint64_t count = 0;
+  set.ForEach([&](const T &elem) {
+    Codec<T>::Write(out, elem);
+    count++;
+  });
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrder;
+  header.elem_size = Codec<T>::kSize;
+  header.count = count;
+  char padded[kDataOffset] = {};
+  std::memcpy(padded, &header, sizeof(header));
+  out.seekp(0);
+  out.write(padded, sizeof(padded));
+  out.close();
+  return static_cast<bool>(out);
+}
+
+// Flushes the file or directory at |path| to storage where the platform
+// allows it. Returns false if that failed
+inline bool Sync(const std::string &path, bool directory) {
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = open(path.c_str(), directory ? O_RDONLY : O_WRONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+#else
+  (void)path;
+  (void)directory;
+  return true;
+#endif
+}
+
+// Writes every element of |set| to |path|, replacing the file. Elements are
+// collected with ForEach, so a set modified meanwhile is saved with the same
+// consistency as ForEach gives. The snapshot is written to |path|.tmp, synced
+// and renamed over |path|, so a save that fails midway, or a crash, leaves
+// the previous snapshot whole. Returns false if the file could not be
+// written
+template <typename T, typename Set>
+bool Save(Set &set, const std::string &path) {
+  static_assert(Codec<T>::kSupported, "No snapshot::Codec for this type");
+  std::string temporary = path + ".tmp";
+  if (!WriteFile<T>(set, temporary) || !Sync(temporary, false) ||
+      std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  // Makes the rename itself durable. The new snapshot is already in place,
+  // so a failure here is not reported
+  size_t slash = path.find_last_of('/');
+  (void)Sync(slash == std::string::npos ? "." : path.substr(0, slash + 1),
+             true);
+  return true;
+}
+
+// Returns true iff |header| is that of a snapshot of |T| this build can read
+template <typename T> bool Valid(const Header &header) {
+  return std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+         header.version == kVersion && header.byte_order == kByteOrder &&
+         header.elem_size == Codec<T>::kSize;
+}
+
+// Adds every element of |elems|, |count| fixed-size records, to |set|
+template <typename T, typename Set>
+void AddRecords(Set &set, const T *elems, size_t count) {
+  std::vector<T> batch;
+  for (size_t begin = 0; begin < count; begin += kBatchSize) {
+    size_t end = std::min(count, begin + kBatchSize);
+    batch.assign(elems + begin, elems + end);
+    set.AddAll(batch);
+  }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// Adds the fixed-size records of the snapshot at |path| to |set| straight
+// out of a read-only mapping of the file
+template <typename T, typename Set>
+bool LoadMapped(Set &set, const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < kDataOffset) {
+    close(fd);
+    return false;
+  }
+  auto size = static_cast<size_t>(info.st_size);
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  Header header{};
+  std::memcpy(&header, mapping, sizeof(header));
+  bool valid = Valid<T>(header) &&
+               (size - kDataOffset) / sizeof(T) >= header.count;
+  if (valid) {
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    auto count = static_cast<size_t>(header.count);
+    set.Reserve(set.Size() + count);
+    AddRecords(set,
+               reinterpret_cast<const T *>(static_cast<const char *>(mapping) +
+                                           kDataOffset),
+               count);
+  }
+  munmap(mapping, size);
+  return valid;
+}
+
+#endif
+
+// Adds the records of the snapshot at |path| to |set|, decoding them one at
+// a time
+template <typename T, typename Set>
+bool LoadStreamed(Set &set, const std::string &path) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  std::streamoff size = in.tellg();
+  in.seekg(0);
+  char padded[kDataOffset];
+  if (size < static_cast<std::streamoff>(kDataOffset) ||
+      !in.read(padded, sizeof(padded))) {
+    return false;
+  }
+  Header header{};
+  std::memcpy(&header, padded, sizeof(header));
+  auto remaining = static_cast<uint64_t>(size) - kDataOffset;
+  // Every record takes at least a byte, which bounds what a corrupt count
+  // makes Reserve allocate
+  if (!Valid<T>(header) || header.count > remaining) {
+    return false;
+  }
+  auto count = static_cast<size_t>(header.count);
+  set.Reserve(set.Size() + count);
+  std::vector<T> batch;
+  for (size_t begin = 0; begin < count; begin += kBatchSize) {
+    batch.resize(std::min(count - begin, kBatchSize));
+    for (auto &elem : batch) {
+      if (!Codec<T>::Read(in, &remaining, &elem)) {
+        return false;
+      }
+    }
+    set.AddAll(batch);
+  }
+  return true;
+}
+
+// Adds the elements of the snapshot at |path| to |set|, which may already
+// hold others. Returns false if the file is missing, was written for another
+// element type, format version or byte order, or is truncated or corrupt; in
+// the last case the elements read so far are in the set
+template <typename T, typename Set>
+bool Load(Set &set, const std::string &path) {
+  static_assert(Codec<T>::kSupported, "No snapshot::Codec for this type");
+#if defined(__unix__) || defined(__APPLE__)
+  if constexpr (Codec<T>::kSize != 0) {
+    return LoadMapped<T>(set, path);
+  }
+#endif
+  return LoadStreamed<T>(set, path);
+}
+
+// Writes every element of |set| to the file at |path|, with the consistency
+// of ForEach. Returns false if the file could not be written
+template <typename T>
+bool SaveSnapshot(HashSetBase<T> &set, const std::string &path) {
+  return Save<T>(set, path);
+}
+
+// Adds the elements of a file written by SaveSnapshot to |set|, reserving
+// room for all of them first. Returns false if the file could not be read
+template <typename T>
+bool LoadSnapshot(HashSetBase<T> &set, const std::string &path) {
+  return Load<T>(set, path);
+}
+
+} // namespace snapshot
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,277 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Optional counters on the hot paths of the hash sets: lock acquisitions and
+// waits, probe lengths and resizes. They are only compiled in when
+// HASH_SET_STATS is defined, which the ENABLE_STATS CMake option does.
+// Otherwise the sets use a plain std::mutex, and every recorder here is empty
+// with calls that compile to nothing.
+namespace stats {
+
+#if defined(HASH_SET_STATS)
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+// Probe lengths below kProbeBuckets - 1 get a bucket each, longer ones share
+// the last
+constexpr size_t kProbeBuckets = 16;
+
+struct LockCounts {
+  uint64_t acquisitions = 0;
+  // Acquisitions that found the lock held and had to wait for it
+  uint64_t contended = 0;
+  uint64_t wait_ns = 0;
+};
+
+// Counters of one set at one point in time
+struct Snapshot {
+  // Counts of every lock, in stripe order
+  std::vector<LockCounts> locks;
+  // probe_lengths[i] is the number of lookups that examined i elements, slots
+  // or groups, depending on the storage engine
+  std::array<uint64_t, kProbeBuckets> probe_lengths{};
+  uint64_t resizes = 0;
+  uint64_t resize_ns = 0;
+  // Part of resize_ns spent while every lock was held
+  uint64_t resize_exclusive_ns = 0;
+
+  // Adds the counts of |other|, lock by lock
+  void Merge(const Snapshot &other) {
+    if (locks.size() < other.locks.size()) {
+      locks.resize(other.locks.size());
+    }
+    for (size_t i = 0; i < other.locks.size(); i++) {
+      locks[i].acquisitions += other.locks[i].acquisitions;
+      locks[i].contended += other.locks[i].contended;
+      locks[i].wait_ns += other.locks[i].wait_ns;
+    }
+    for (size_t i = 0; i < kProbeBuckets; i++) {
+      probe_lengths[i] += other.probe_lengths[i];
+    }
+    resizes += other.resizes;
+    resize_ns += other.resize_ns;
+    resize_exclusive_ns += other.resize_exclusive_ns;
+  }
+};
+
+// Nanoseconds since construction. Always 0, without reading the clock, when
+// statistics are off
+class Timer {
+public:
+  Timer() {
+    if constexpr (kEnabled) {
+      begin_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  [[nodiscard]] uint64_t ElapsedNanos() const {
+    if constexpr (kEnabled) {
+      return static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - begin_)
+              .count());
+    }
+    return 0;
+  }
+
+private:
+  std::chrono::steady_clock::time_point begin_;
+};
+
+// Mutex that counts its acquisitions, how many of them found it held, and the
+// time spent waiting for it. The counters are only written by the holder
+class CountingMutex {
+public:
+  void lock() {
+    if (!mutex_.try_lock()) {
+      Timer timer;
+      mutex_.lock();
+      Bump(contended_, 1);
+      Bump(wait_ns_, timer.ElapsedNanos());
+    }
+    Bump(acquisitions_, 1);
+  }
+
+  bool try_lock() {
+    if (!mutex_.try_lock()) {
+      return false;
+    }
+    Bump(acquisitions_, 1);
+    return true;
+  }
+
+  void unlock() { mutex_.unlock(); }
+
+  [[nodiscard]] LockCounts Counts() const {
+    LockCounts counts;
+    counts.acquisitions = acquisitions_.load(std::memory_order_relaxed);
+    counts.contended = contended_.load(std::memory_order_relaxed);
+    counts.wait_ns = wait_ns_.load(std::memory_order_relaxed);
+    return counts;
+  }
+
+private:
+  std::mutex mutex_;
+  std::atomic<uint64_t> acquisitions_{0};
+  std::atomic<uint64_t> contended_{0};
+  std::atomic<uint64_t> wait_ns_{0};
+
+  static void Bump(std::atomic<uint64_t> &counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount,
+                  std::memory_order_relaxed);
+  }
+};
+
+// Mutex of the sets and their stripes
+#if defined(HASH_SET_STATS)
+using Mutex = CountingMutex;
+#else
+using Mutex = std::mutex;
+#endif
+
+// Locks other than CountingMutex are not counted
+template <typename Lock> LockCounts CountsOf(const Lock & /*lock*/) {
+  return {};
+}
+
+inline LockCounts CountsOf(const CountingMutex &mutex) {
+  return mutex.Counts();
+}
+
+// Probe lengths of the lookups in a set, shared by every table the set grows
+class ProbeHistogram {
+public:
+  void Record(size_t length) {
+    counts_[std::min(length, kProbeBuckets - 1)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  void CopyTo(Snapshot *snapshot) const {
+    for (size_t i = 0; i < kProbeBuckets; i++) {
+      snapshot->probe_lengths[i] = counts_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, kProbeBuckets> counts_{};
+};
+
+// Link from a storage engine to the probe histogram of its set, copied along
+// when the table grows. Empty when statistics are off
+class ProbeRecorder {
+public:
+#if defined(HASH_SET_STATS)
+  void Attach(ProbeHistogram *histogram) { histogram_ = histogram; }
+
+  void Record(size_t length) const {
+    if (histogram_ != nullptr) {
+      histogram_->Record(length);
+    }
+  }
+
+private:
+  ProbeHistogram *histogram_ = nullptr;
+#else
+  void Attach(ProbeHistogram * /*histogram*/) {}
+
+  void Record(size_t /*length*/) const {}
+#endif
+};
+
+// Number and duration of the Resize() calls of a set
+class ResizeCounters {
+public:
+  void Record(uint64_t ns, uint64_t exclusive_ns) {
+    resizes_.fetch_add(1, std::memory_order_relaxed);
+    ns_.fetch_add(ns, std::memory_order_relaxed);
+    exclusive_ns_.fetch_add(exclusive_ns, std::memory_order_relaxed);
+  }
+
+  void CopyTo(Snapshot *snapshot) const {
+    snapshot->resizes = resizes_.load(std::memory_order_relaxed);
+    snapshot->resize_ns = ns_.load(std::memory_order_relaxed);
+    snapshot->resize_exclusive_ns =
+        exclusive_ns_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> resizes_{0};
+  std::atomic<uint64_t> ns_{0};
+  std::atomic<uint64_t> exclusive_ns_{0};
+};
+
+// Times a Resize() call until destruction, and separately the part after
+// Exclusive() is called, once every lock is held. Declare it before the locks
+// so that releasing them is counted too
+class ResizeScope {
+public:
+  explicit ResizeScope(ResizeCounters *counters) : counters_(counters) {}
+
+  ResizeScope(const ResizeScope &) = delete;
+  ResizeScope &operator=(const ResizeScope &) = delete;
+
+  ~ResizeScope() {
+    if constexpr (kEnabled) {
+      counters_->Record(total_.ElapsedNanos(),
+                        exclusive_ ? exclusive_timer_.ElapsedNanos() : 0);
+    }
+  }
+
+  void Exclusive() {
+    if constexpr (kEnabled) {
+      exclusive_timer_ = Timer();
+      exclusive_ = true;
+    }
+  }
+
+private:
+  ResizeCounters *counters_;
+  Timer total_;
+  Timer exclusive_timer_;
+  bool exclusive_ = false;
+};
+
+// Prints the totals of |snapshot|, the busiest lock and the probe lengths
+inline void Print(std::ostream &out, const Snapshot &snapshot) {
+  LockCounts total;
+  LockCounts busiest;
+  for (const auto &lock : snapshot.locks) {
+    total.acquisitions += lock.acquisitions;
+    total.contended += lock.contended;
+    total.wait_ns += lock.wait_ns;
+    if (lock.acquisitions > busiest.acquisitions) {
+      busiest = lock;
+    }
+  }
+  out << "  locks: " << snapshot.locks.size() << ", acquisitions "
+      << total.acquisitions << ", contended " << total.contended
+      << ", waited " << total.wait_ns / 1000 << " us, busiest lock "
+      << busiest.acquisitions << " acquisitions\n";
+  out << "  probe lengths:";
+  for (size_t i = 0; i < kProbeBuckets; i++) {
+    if (snapshot.probe_lengths[i] != 0) {
+      out << " " << i << (i + 1 == kProbeBuckets ? "+" : "") << ":"
+          << snapshot.probe_lengths[i];
+    }
+  }
+  out << "\n  resizes: " << snapshot.resizes << ", took "
+      << snapshot.resize_ns / 1000 << " us, "
+      << snapshot.resize_exclusive_ns / 1000 << " us with every lock held"
+      << std::endl;
+}
+
+} // namespace stats
+
+#endif // STATS_H
@@ -0,0 +1,69 @@
+#ifndef STRIPING_H
+#define STRIPING_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "src/hashing.h"
+#include "src/stats.h"
+
+// Lock stripes shared by the lock-striped hash sets
+namespace striping {
+
+// Distance that keeps two objects off the same cache line. GCC rejects any use
+// of std::hardware_destructive_interference_size in a header, as its value
+// depends on the tuning flags, so the common line size is assumed there
+#if defined(__cpp_lib_hardware_interference_size) && defined(__clang__)
+constexpr size_t kCacheLineSize = std::hardware_destructive_interference_size;
+#else
+constexpr size_t kCacheLineSize = 64;
+#endif
+
+// The lock of one stripe, its version counter, which is odd while a writer is
+// inside the stripe, and the number of elements in the stripe. Stripes are
+// stored inline in one array, each on its own cache line so that threads using
+// neighbouring stripes do not contend. |Lock| is the lock policy of the set
+template <typename Lock = stats::Mutex> struct alignas(kCacheLineSize) Stripe {
+  Lock mutex;
+  std::atomic<size_t> version{0};
+  // Only written under |mutex|, but read without it by Size()
+  std::atomic<size_t> size{0};
+
+  // Adds |count| to |size|. Must hold |mutex|, so no atomic increment is needed
+  void AddToSize(size_t count) {
+    size.store(size.load(std::memory_order_relaxed) + count,
+               std::memory_order_relaxed);
+  }
+
+  // Subtracts |count| from |size|. Must hold |mutex|
+  void SubtractFromSize(size_t count) {
+    size.store(size.load(std::memory_order_relaxed) - count,
+               std::memory_order_relaxed);
+  }
+};
+
+// Returns the number of stripes used unless the caller asks for another: a few
+// per hardware thread, so that threads rarely wait on each other even while the
+// table is small
+inline size_t DefaultStripeCount() {
+  size_t threads = std::thread::hardware_concurrency();
+  return 4 * (threads > 0 ? threads : 1);
+}
+
+// Returns the slot of the calling thread among |num_slots|, a power of two,
+// for per-thread state spread over a fixed number of slots. Thread ids are
+// often addresses with their low bits clear, so they are scrambled first
+inline size_t ThreadIndex(size_t num_slots) {
+  static thread_local const size_t thread_hash =
+      static_cast<size_t>(hashing::Mix64(
+          std::hash<std::thread::id>()(std::this_thread::get_id())));
+  return thread_hash & (num_slots - 1);
+}
+
+} // namespace striping
+
+#endif // STRIPING_H
@@ -0,0 +1,433 @@
+#ifndef SWISS_TABLE_H
+#define SWISS_TABLE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/hashing.h"
+#include "src/resizing.h"
+#include "src/stats.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bucket storage in the style of Swiss tables. Next to the slots there is an
+// array of control bytes, one per slot, holding either a 7-bit fragment of the
+// hash of the element in the slot or a marker for an empty or deleted slot.
+// Slots are probed a group at a time: the control bytes of the whole group are
+// compared against the fragment with a single vector instruction, and only the
+// slots whose fragment matches have their elements compared.
+//
+// The group width is picked at compile time: 32 slots with AVX2, 16 with SSE2,
+// and otherwise 8 slots using plain 64-bit arithmetic. As with
+// OpenAddressingTable, the slots are split into one contiguous region per lock,
+// each holding a power of two of groups. See ChainedTable for the storage
+// engine interface. The slots are a single allocation, so |Allocator| is used
+// as is, without per-region pools.
+template <typename T, typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>,
+          typename Allocator = std::allocator<T>>
+class SwissTable {
+public:
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+
+  explicit SwissTable(size_t capacity, size_t num_regions = 1) {
+    num_regions_ = hashing::RoundUpToPowerOfTwo(num_regions);
+    region_shift_ = hashing::Log2(num_regions_);
+    size_t region_capacity = capacity / num_regions_;
+    num_groups_ = hashing::RoundUpToPowerOfTwo(
+        (region_capacity + Group::kWidth - 1) / Group::kWidth);
+    region_capacity_ = num_groups_ * Group::kWidth;
+    ctrl_ = Controls(region_capacity_ * num_regions_, kEmpty);
+    slots_ = std::vector<T, Allocator>(region_capacity_ * num_regions_);
+    region_used_ = std::vector<size_t>(num_regions_, 0);
+  }
+
+  // Returns the number of slots
+  [[nodiscard]] size_t Capacity() const { return slots_.size(); }
+
+  // Returns true iff an element equal to |key|, whose hash is |hash|, is in
+  // the table
+  template <typename K>
+  [[nodiscard]] bool Contains(size_t hash, const K &key) const {
+    return Find(hash, key) != kNotFound;
+  }
+
+  // Stores |elem| in the first empty or deleted slot of its probe sequence.
+  // Returns false if it was already present. Callers check that the region of
+  // |hash| is not Full() first; only Grown goes past that, when splitting a
+  // region sends most of its elements to the same half
+  bool Insert(size_t hash, const T &elem) {
+    if (Find(hash, elem) != kNotFound) {
+      return false;
+    }
+    Place(hash, elem);
+    return true;
+  }
+
+  // Moves |elem| into the table, unless it was already present
+  bool Insert(size_t hash, T &&elem) {
+    if (Find(hash, elem) != kNotFound) {
+      return false;
+    }
+    Place(hash, std::move(elem));
+    return true;
+  }
+
+  // Removes |elem|. Its slot is marked deleted rather than empty unless its
+  // group still has an empty slot, in which case no probe sequence can have
+  // passed through the group. Returns false if it was absent
+  bool Erase(size_t hash, const T &elem) {
+    size_t index = Find(hash, elem);
+    if (index == kNotFound) {
+      return false;
+    }
+    size_t base = RegionBase(hash);
+    size_t group_base =
+        base + (index - base) / Group::kWidth * Group::kWidth;
+    if (Group(&ctrl_[group_base]).MatchEmpty() != 0) {
+      ctrl_[index] = kEmpty;
+      region_used_[Region(hash)]--;
+    } else {
+      ctrl_[index] = kDeleted;
+    }
+    slots_[index] = T();
+    return true;
+  }
+
+  // Hints the processor to start loading the control bytes and slots of the
+  // home group of |hash|
+  void Prefetch(size_t hash) const {
+    size_t group_base = RegionBase(hash) + HomeGroup(Mix(hash)) * Group::kWidth;
+    __builtin_prefetch(&ctrl_[group_base]);
+    __builtin_prefetch(&slots_[group_base]);
+  }
+
+  // Returns true iff the used slots, deleted ones included, of the region of
+  // |hash| reached 7/8 of the region, so the table must grow before another
+  // element can be inserted there
+  [[nodiscard]] bool Full(size_t hash) const {
+    return region_used_[Region(hash)] >=
+           region_capacity_ - region_capacity_ / 8;
+  }
+
+  // Calls |visit| on every element
+  template <typename Visit> void ForEach(Visit visit) const {
+    for (size_t i = 0; i < slots_.size(); i++) {
+      if (IsFull(ctrl_[i])) {
+        visit(slots_[i]);
+      }
+    }
+  }
+
+  // Calls |visit| on every element of |region|
+  template <typename Visit>
+  void ForEachInRegion(size_t region, Visit visit) const {
+    size_t base = region * region_capacity_;
+    for (size_t i = base; i < base + region_capacity_; i++) {
+      if (IsFull(ctrl_[i])) {
+        visit(slots_[i]);
+      }
+    }
+  }
+
+  // Records the probe length of every lookup in |histogram|, as will the
+  // tables grown from this one
+  void AttachProbes(stats::ProbeHistogram *histogram) {
+    probes_.Attach(histogram);
+  }
+
+  // The control and slot arrays are only replaced by Rehash
+  static constexpr bool kStableStorage = true;
+
+  // Regions are Full at 7/8
+  static constexpr double kMaxLoad = 0.875;
+
+  // Doubles every region and moves all elements over, dropping deleted slots
+  void Grow() { Grow(num_regions_); }
+
+  // Doubles the slots, split into |num_regions| regions
+  void Grow(size_t num_regions) { Rehash(slots_.size() * 2, num_regions); }
+
+  // Returns a copy of the table with every region doubled, leaving this one
+  // untouched
+  [[nodiscard]] SwissTable Grown() const { return Grown(num_regions_); }
+
+  // Returns a copy of the table with twice the slots, split into
+  // |num_regions| regions, for sets whose lock count grows with the table
+  [[nodiscard]] SwissTable Grown(size_t num_regions) const {
+    return Rehashed(slots_.size() * 2, num_regions);
+  }
+
+  // Rebuilds the table with |capacity| slots split into |num_regions|
+  // regions, and moves all elements over without comparing them, as they are
+  // known to be distinct. Deleted slots are dropped. When shrinking, regions
+  // are kept large enough for the elements that fall into them not to fill
+  // them up
+  template <typename ForEachIndex = resizing::SerialFor>
+  void Rehash(size_t capacity, size_t num_regions,
+              ForEachIndex for_each_index = {}) {
+    SwissTable rehashed(FitCapacity(capacity, num_regions), num_regions);
+    rehashed.probes_ = probes_;
+    ForEachOldRegion(rehashed, for_each_index, [&](size_t region) {
+      size_t base = region * region_capacity_;
+      for (size_t i = base; i < base + region_capacity_; i++) {
+        if (IsFull(ctrl_[i])) {
+          rehashed.Place(Hash()(slots_[i]), std::move(slots_[i]));
+        }
+      }
+    });
+    *this = std::move(rehashed);
+  }
+
+  // Returns a copy of the table rebuilt as Rehash does
+  template <typename ForEachIndex = resizing::SerialFor>
+  [[nodiscard]] SwissTable Rehashed(size_t capacity, size_t num_regions,
+                                    ForEachIndex for_each_index = {}) const {
+    SwissTable rehashed(FitCapacity(capacity, num_regions), num_regions);
+    rehashed.probes_ = probes_;
+    ForEachOldRegion(rehashed, for_each_index, [&](size_t region) {
+      size_t base = region * region_capacity_;
+      for (size_t i = base; i < base + region_capacity_; i++) {
+        if (IsFull(ctrl_[i])) {
+          rehashed.Place(Hash()(slots_[i]), slots_[i]);
+        }
+      }
+    });
+    return rehashed;
+  }
+
+private:
+  static constexpr uint8_t kEmpty = 0x80;
+  static constexpr uint8_t kDeleted = 0xFE;
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+#if defined(__AVX2__)
+  // The control bytes of 32 consecutive slots, one mask bit per slot
+  struct Group {
+    using Mask = uint32_t;
+    static constexpr size_t kWidth = 32;
+
+    explicit Group(const uint8_t *ctrl)
+        : ctrl_(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(ctrl))) {
+    }
+
+    Mask Match(uint8_t fragment) const {
+      __m256i pattern = _mm256_set1_epi8(static_cast<char>(fragment));
+      return static_cast<Mask>(
+          _mm256_movemask_epi8(_mm256_cmpeq_epi8(pattern, ctrl_)));
+    }
+
+    Mask MatchEmpty() const { return Match(kEmpty); }
+
+    // Empty and deleted are the only control bytes with the top bit set
+    Mask MatchEmptyOrDeleted() const {
+      return static_cast<Mask>(_mm256_movemask_epi8(ctrl_));
+    }
+
+    static size_t LowestSlot(Mask mask) {
+      return static_cast<size_t>(__builtin_ctz(mask));
+    }
+
+    __m256i ctrl_;
+  };
+#elif defined(__SSE2__)
+  // The control bytes of 16 consecutive slots, one mask bit per slot
+  struct Group {
+    using Mask = uint32_t;
+    static constexpr size_t kWidth = 16;
+
+    explicit Group(const uint8_t *ctrl)
+        : ctrl_(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {}
+
+    Mask Match(uint8_t fragment) const {
+      __m128i pattern = _mm_set1_epi8(static_cast<char>(fragment));
+      return static_cast<Mask>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(pattern, ctrl_)));
+    }
+
+    Mask MatchEmpty() const { return Match(kEmpty); }
+
+    // Empty and deleted are the only control bytes with the top bit set
+    Mask MatchEmptyOrDeleted() const {
+      return static_cast<Mask>(_mm_movemask_epi8(ctrl_));
+    }
+
+    static size_t LowestSlot(Mask mask) {
+      return static_cast<size_t>(__builtin_ctz(mask));
+    }
+
+    __m128i ctrl_;
+  };
+#else
+  // The control bytes of 8 consecutive slots packed in a word. Masks have the
+  // top bit of each matching byte set. Match() may report false positives,
+  // which are harmless as every candidate slot is compared anyway
+  struct Group {
+    using Mask = uint64_t;
+    static constexpr size_t kWidth = 8;
+    static constexpr uint64_t kLsbs = 0x0101010101010101ULL;
+    static constexpr uint64_t kMsbs = 0x8080808080808080ULL;
+
+    explicit Group(const uint8_t *ctrl) { std::memcpy(&ctrl_, ctrl, kWidth); }
+
+    Mask Match(uint8_t fragment) const {
+      uint64_t x = ctrl_ ^ (kLsbs * fragment);
+      return (x - kLsbs) & ~x & kMsbs;
+    }
+
+    // Bit 1 is clear in kEmpty and set in kDeleted
+    Mask MatchEmpty() const { return ctrl_ & ~(ctrl_ << 6) & kMsbs; }
+
+    // Empty and deleted are the only control bytes with the top bit set
+    Mask MatchEmptyOrDeleted() const { return ctrl_ & kMsbs; }
+
+    static size_t LowestSlot(Mask mask) {
+      return static_cast<size_t>(__builtin_ctzll(mask)) / 8;
+    }
+
+    uint64_t ctrl_;
+  };
+#endif
+
+  size_t num_regions_;
+  // log2(num_regions_)
+  size_t region_shift_;
+  size_t num_groups_;
+  size_t region_capacity_;
+  using Controls = std::vector<
+      uint8_t, typename std::allocator_traits<Allocator>::template rebind_alloc<
+                   uint8_t>>;
+
+  Controls ctrl_;
+  std::vector<T, Allocator> slots_;
+  // Number of full or deleted slots in every region
+  std::vector<size_t> region_used_;
+  stats::ProbeRecorder probes_;
+
+  static bool IsFull(uint8_t ctrl) { return (ctrl & 0x80) == 0; }
+
+  // Scrambles the part of |hash| not used to pick the region, so that a weak
+  // |Hash| such as std::hash still spreads over the groups and fragments
+  uint64_t Mix(size_t hash) const {
+    uint64_t mixed =
+        static_cast<uint64_t>(hash >> region_shift_) * 0x9E3779B97F4A7C15ULL;
+    return mixed ^ (mixed >> 29);
+  }
+
+  // The 7 bit hash fragment stored in the control byte
+  static uint8_t Fragment(uint64_t mixed) {
+    return static_cast<uint8_t>(mixed >> 57);
+  }
+
+  size_t HomeGroup(uint64_t mixed) const {
+    return static_cast<size_t>(mixed) & (num_groups_ - 1);
+  }
+
+  size_t Region(size_t hash) const { return hash & (num_regions_ - 1); }
+
+  // Returns |capacity|, or the smallest larger capacity whose regions, split
+  // |num_regions| ways, would still not be Full once the elements are placed
+  size_t FitCapacity(size_t capacity, size_t num_regions) const {
+    if (capacity >= slots_.size()) {
+      return capacity;
+    }
+    num_regions = hashing::RoundUpToPowerOfTwo(num_regions);
+    std::vector<size_t> sizes(num_regions, 0);
+    for (size_t i = 0; i < slots_.size(); i++) {
+      if (IsFull(ctrl_[i])) {
+        sizes[Hash()(slots_[i]) & (num_regions - 1)]++;
+      }
+    }
+    size_t largest = *std::max_element(sizes.begin(), sizes.end());
+    size_t region_capacity =
+        hashing::RoundUpToPowerOfTwo(
+            (capacity / num_regions + Group::kWidth - 1) / Group::kWidth) *
+        Group::kWidth;
+    while (largest >= region_capacity - region_capacity / 8) {
+      region_capacity *= 2;
+    }
+    return std::max(capacity, region_capacity * num_regions);
+  }
+
+  size_t RegionBase(size_t hash) const {
+    return Region(hash) * region_capacity_;
+  }
+
+  // Runs |work| on every region of this table through |for_each_index|, or
+  // serially if |rehashed| has fewer regions. See ChainedTable
+  template <typename ForEachIndex, typename Work>
+  void ForEachOldRegion(const SwissTable &rehashed,
+                        ForEachIndex for_each_index, Work work) const {
+    if (rehashed.num_regions_ >= num_regions_) {
+      for_each_index(num_regions_, work);
+    } else {
+      resizing::SerialFor()(num_regions_, work);
+    }
+  }
+
+  // Stores |elem|, which is not in the table, in the first empty or deleted
+  // slot of its probe sequence
+  template <typename U> void Place(size_t hash, U &&elem) {
+    size_t base = RegionBase(hash);
+    uint64_t mixed = Mix(hash);
+    size_t group = HomeGroup(mixed);
+    for (size_t probes = 0; probes < num_groups_; probes++) {
+      size_t group_base = base + group * Group::kWidth;
+      typename Group::Mask available =
+          Group(&ctrl_[group_base]).MatchEmptyOrDeleted();
+      if (available != 0) {
+        size_t index = group_base + Group::LowestSlot(available);
+        if (ctrl_[index] == kEmpty) {
+          region_used_[Region(hash)]++;
+        }
+        ctrl_[index] = Fragment(mixed);
+        slots_[index] = std::forward<U>(elem);
+        return;
+      }
+      group = (group + 1) & (num_groups_ - 1);
+    }
+    assert(false && "Insert into a full region");
+  }
+
+  // Returns the index of the slot holding an element equal to |key|, or
+  // kNotFound. Stops at the first group with an empty slot, as an insert would
+  // have used it
+  template <typename K> size_t Find(size_t hash, const K &key) const {
+    size_t base = RegionBase(hash);
+    uint64_t mixed = Mix(hash);
+    uint8_t fragment = Fragment(mixed);
+    size_t group = HomeGroup(mixed);
+    for (size_t probes = 0; probes < num_groups_; probes++) {
+      size_t group_base = base + group * Group::kWidth;
+      Group ctrl(&ctrl_[group_base]);
+      for (typename Group::Mask match = ctrl.Match(fragment); match != 0;
+           match &= match - 1) {
+        size_t index = group_base + Group::LowestSlot(match);
+        if (IsFull(ctrl_[index]) && KeyEqual()(slots_[index], key)) {
+          probes_.Record(probes + 1);
+          return index;
+        }
+      }
+      if (ctrl.MatchEmpty() != 0) {
+        probes_.Record(probes + 1);
+        return kNotFound;
+      }
+      group = (group + 1) & (num_groups_ - 1);
+    }
+    probes_.Record(num_groups_);
+    return kNotFound;
+  }
+};
+
+#endif // SWISS_TABLE_H
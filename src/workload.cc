@@ -0,0 +1,516 @@
+#include "src/workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <tuple>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "src/hashing.h"
+
+namespace workload {
+
+namespace {
+
+void PrintUsage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " [--flag=value ...]\n"
+      << "  --threads=N|sweep    threads running operations, or 1, 2, 4, ...\n"
+      << "                       up to the hardware concurrency (default 1)\n"
+      << "  --repetitions=N      runs averaged for every point (default 1)\n"
+      << "  --pin=POLICY         none, compact or scatter (default none)\n"
+      << "  --format=NAME        text, csv or json (default text)\n"
+      << "  --capacity=N         initial capacity of every set (default 16)\n"
+      << "  --mix=R/I/D          percentage of Contains/Add/Remove calls,\n"
+      << "                       summing to 100 (default 95/4/1)\n"
+      << "  --distribution=NAME  uniform, zipfian, sequential or hotspot\n"
+      << "                       (default zipfian)\n"
+      << "  --keys=N             size of the key range (default 1048576)\n"
+      << "  --prefill=F          fraction of the keys added up front\n"
+      << "                       (default 0.5)\n"
+      << "  --duration-ms=N      length of every run (default 2000)\n"
+      << "  --dispatch=NAME      static, virtual or both: call the sets\n"
+      << "                       directly or through HashSetBase\n"
+      << "                       (default static)\n"
+      << "  --sets=A,B,...       sets to run (default all)" << std::endl;
+}
+
+std::vector<std::string> Split(const std::string &value, char separator) {
+  std::vector<std::string> parts;
+  std::stringstream stream(value);
+  std::string part;
+  while (std::getline(stream, part, separator)) {
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+bool ParseDistribution(const std::string &value, Distribution *distribution) {
+  if (value == "uniform") {
+    *distribution = Distribution::kUniform;
+  } else if (value == "zipfian") {
+    *distribution = Distribution::kZipfian;
+  } else if (value == "sequential") {
+    *distribution = Distribution::kSequential;
+  } else if (value == "hotspot") {
+    *distribution = Distribution::kHotspot;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParsePinPolicy(const std::string &value, PinPolicy *pin) {
+  if (value == "none") {
+    *pin = PinPolicy::kNone;
+  } else if (value == "compact") {
+    *pin = PinPolicy::kCompact;
+  } else if (value == "scatter") {
+    *pin = PinPolicy::kScatter;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseFormat(const std::string &value, Format *format) {
+  if (value == "text") {
+    *format = Format::kText;
+  } else if (value == "csv") {
+    *format = Format::kCsv;
+  } else if (value == "json") {
+    *format = Format::kJson;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseDispatch(const std::string &value, Dispatch *dispatch) {
+  if (value == "static") {
+    *dispatch = Dispatch::kStatic;
+  } else if (value == "virtual") {
+    *dispatch = Dispatch::kVirtual;
+  } else if (value == "both") {
+    *dispatch = Dispatch::kBoth;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseFlag(const std::string &name, const std::string &value,
+               Options *options) {
+  if (name == "threads") {
+    options->sweep = value == "sweep";
+    if (!options->sweep) {
+      options->num_threads = std::stoul(value);
+    }
+  } else if (name == "repetitions") {
+    options->repetitions = std::stoul(value);
+  } else if (name == "pin") {
+    return ParsePinPolicy(value, &options->pin);
+  } else if (name == "format") {
+    return ParseFormat(value, &options->format);
+  } else if (name == "capacity") {
+    options->initial_capacity = std::stoul(value);
+  } else if (name == "mix") {
+    std::vector<std::string> parts = Split(value, '/');
+    if (parts.size() != kNumOperations) {
+      return false;
+    }
+    size_t total = 0;
+    for (size_t op = 0; op < kNumOperations; op++) {
+      options->mix[op] = std::stoul(parts[op]);
+      total += options->mix[op];
+    }
+    return total == 100;
+  } else if (name == "distribution") {
+    return ParseDistribution(value, &options->distribution);
+  } else if (name == "keys") {
+    options->key_range = std::stoul(value);
+  } else if (name == "prefill") {
+    options->prefill = std::stod(value);
+    return options->prefill >= 0 && options->prefill <= 1;
+  } else if (name == "duration-ms") {
+    options->duration_ms = std::stoul(value);
+  } else if (name == "dispatch") {
+    return ParseDispatch(value, &options->dispatch);
+  } else if (name == "sets") {
+    options->sets = Split(value, ',');
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *const kOperationNames[kNumOperations] = {"contains", "add",
+                                                     "remove"};
+
+} // namespace
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t equals = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || equals == std::string::npos) {
+      PrintUsage(argv[0]);
+      return false;
+    }
+    bool parsed = false;
+    try {
+      parsed = ParseFlag(arg.substr(2, equals - 2), arg.substr(equals + 1),
+                         options);
+    } catch (const std::exception &) {
+      parsed = false;
+    }
+    if (!parsed) {
+      std::cerr << "Invalid flag " << arg << std::endl;
+      PrintUsage(argv[0]);
+      return false;
+    }
+  }
+  if (options->num_threads == 0 || options->repetitions == 0 ||
+      options->key_range == 0 ||
+      options->key_range > static_cast<size_t>(INT32_MAX)) {
+    std::cerr << "--threads and --repetitions must be positive and --keys in "
+                 "[1, 2^31)"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+KeyGenerator::KeyGenerator(const Options &options)
+    : distribution_(options.distribution), key_range_(options.key_range),
+      num_threads_(options.num_threads) {
+  if (distribution_ == Distribution::kZipfian) {
+    for (size_t i = 1; i <= key_range_; i++) {
+      zeta_n_ += 1 / std::pow(static_cast<double>(i), kZipfianTheta);
+    }
+    double zeta_2 = 1 + 1 / std::pow(2.0, kZipfianTheta);
+    alpha_ = 1 / (1 - kZipfianTheta);
+    eta_ = (1 - std::pow(2.0 / static_cast<double>(key_range_),
+                         1 - kZipfianTheta)) /
+           (1 - zeta_2 / zeta_n_);
+  }
+}
+
+KeyGenerator KeyGenerator::ForThread(size_t id) const {
+  KeyGenerator generator = *this;
+  generator.engine_.seed(hashing::Mix64(id + 1));
+  generator.next_sequential_ = id * (key_range_ / num_threads_);
+  return generator;
+}
+
+int KeyGenerator::Next() {
+  size_t key = 0;
+  switch (distribution_) {
+  case Distribution::kUniform:
+    key = engine_() % key_range_;
+    break;
+  case Distribution::kZipfian:
+    key = NextZipfian();
+    break;
+  case Distribution::kSequential:
+    key = next_sequential_++ % key_range_;
+    break;
+  case Distribution::kHotspot: {
+    size_t hot_keys = std::max<size_t>(
+        1, static_cast<size_t>(static_cast<double>(key_range_) *
+                               kHotKeyFraction));
+    if (unit_(engine_) < kHotOperationFraction) {
+      key = engine_() % hot_keys;
+    } else {
+      key = engine_() % key_range_;
+    }
+    break;
+  }
+  }
+  return static_cast<int>(key);
+}
+
+size_t KeyGenerator::NextZipfian() {
+  double u = unit_(engine_);
+  double uz = u * zeta_n_;
+  if (uz < 1) {
+    return 0;
+  }
+  if (uz < 1 + std::pow(0.5, kZipfianTheta)) {
+    return 1 % key_range_;
+  }
+  double key = static_cast<double>(key_range_) *
+               std::pow(eta_ * u - eta_ + 1, alpha_);
+  return std::min(static_cast<size_t>(key), key_range_ - 1);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < counts_.size(); i++) {
+    counts_[i] += other.counts_[i];
+  }
+}
+
+uint64_t LatencyHistogram::Count() const {
+  uint64_t count = 0;
+  for (uint64_t bucket_count : counts_) {
+    count += bucket_count;
+  }
+  return count;
+}
+
+uint64_t LatencyHistogram::Percentile(double quantile) const {
+  uint64_t count = Count();
+  if (count == 0) {
+    return 0;
+  }
+  auto rank = static_cast<uint64_t>(
+      std::ceil(quantile * static_cast<double>(count)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    seen += counts_[i];
+    if (seen >= std::max<uint64_t>(rank, 1)) {
+      return LowerBound(i);
+    }
+  }
+  return LowerBound(counts_.size() - 1);
+}
+
+// Values below kSubBuckets get a bucket each. Past that, the position of the
+// top bit picks a row of kSubBuckets buckets, and the bits below it the bucket
+size_t LatencyHistogram::BucketOf(uint64_t nanos) {
+  if (nanos < kSubBuckets) {
+    return static_cast<size_t>(nanos);
+  }
+  size_t top_bit = 63 - static_cast<size_t>(__builtin_clzll(nanos));
+  size_t sub_bucket =
+      static_cast<size_t>(nanos >> (top_bit - kSubBucketBits)) &
+      (kSubBuckets - 1);
+  return (top_bit - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+}
+
+uint64_t LatencyHistogram::LowerBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  size_t top_bit = bucket / kSubBuckets + kSubBucketBits - 1;
+  uint64_t sub_bucket = bucket % kSubBuckets;
+  return (kSubBuckets + sub_bucket) << (top_bit - kSubBucketBits);
+}
+
+void Prefill(HashSetBase<int> &hash_set, const Options &options) {
+  auto threshold = static_cast<uint64_t>(
+      options.prefill * static_cast<double>(UINT32_MAX));
+  std::vector<int> keys;
+  for (size_t i = 0; i < options.key_range; i++) {
+    if ((hashing::Mix64(i) & UINT32_MAX) < threshold) {
+      keys.push_back(static_cast<int>(i));
+    }
+  }
+  hash_set.AddAll(keys);
+}
+
+std::vector<size_t> ThreadCounts(const Options &options) {
+  if (!options.sweep) {
+    return {options.num_threads};
+  }
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<size_t> counts;
+  for (size_t count = 1; count < max_threads; count *= 2) {
+    counts.push_back(count);
+  }
+  counts.push_back(max_threads);
+  return counts;
+}
+
+#if defined(__linux__)
+
+namespace {
+
+// Returns the socket of |cpu| as reported by sysfs, or 0 if it is unknown
+size_t SocketOf(size_t cpu) {
+  std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                     "/topology/physical_package_id");
+  size_t socket = 0;
+  if (!(file >> socket)) {
+    return 0;
+  }
+  return socket;
+}
+
+} // namespace
+
+std::vector<size_t> CpuOrder(PinPolicy policy) {
+  if (policy == PinPolicy::kNone) {
+    return {};
+  }
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return {};
+  }
+  // (rank, socket, cpu), where rank counts the allowed CPUs of the same
+  // socket seen before this one
+  std::vector<std::tuple<size_t, size_t, size_t>> cpus;
+  std::vector<size_t> per_socket;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) {
+      continue;
+    }
+    size_t socket = SocketOf(cpu);
+    if (socket >= per_socket.size()) {
+      per_socket.resize(socket + 1, 0);
+    }
+    cpus.emplace_back(per_socket[socket]++, socket, cpu);
+  }
+  if (policy == PinPolicy::kCompact) {
+    std::sort(cpus.begin(), cpus.end(), [](const auto &a, const auto &b) {
+      return std::tie(std::get<1>(a), std::get<0>(a)) <
+             std::tie(std::get<1>(b), std::get<0>(b));
+    });
+  } else {
+    std::sort(cpus.begin(), cpus.end());
+  }
+  std::vector<size_t> order;
+  for (const auto &cpu : cpus) {
+    order.push_back(std::get<2>(cpu));
+  }
+  return order;
+}
+
+void PinThread(std::thread &thread, size_t cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+}
+
+#else
+
+std::vector<size_t> CpuOrder(PinPolicy /*policy*/) { return {}; }
+
+void PinThread(std::thread & /*thread*/, size_t /*cpu*/) {}
+
+#endif
+
+namespace {
+
+double Throughput(const Result &result) {
+  uint64_t total = 0;
+  for (const auto &histogram : result.latencies) {
+    total += histogram.Count();
+  }
+  return static_cast<double>(total) / result.seconds;
+}
+
+} // namespace
+
+Report::Report(const Options &options) : format_(options.format) {
+  if (format_ == Format::kCsv) {
+    std::cout << "set,threads,repetitions,mean_ops_per_s,stddev_ops_per_s,"
+                 "speedup,p50_ns,p99_ns,p999_ns"
+              << std::endl;
+  } else if (format_ == Format::kJson) {
+    std::cout << "[";
+  }
+}
+
+void Report::Add(const std::string &name, size_t num_threads,
+                 const std::vector<Result> &results) {
+  double mean = 0;
+  for (const auto &result : results) {
+    mean += Throughput(result);
+  }
+  mean /= static_cast<double>(results.size());
+  double variance = 0;
+  for (const auto &result : results) {
+    variance += (Throughput(result) - mean) * (Throughput(result) - mean);
+  }
+  if (results.size() > 1) {
+    variance /= static_cast<double>(results.size() - 1);
+  }
+  double stddev = std::sqrt(variance);
+  if (name == "sequential" && num_threads == 1) {
+    baseline_ = mean;
+  }
+  double speedup = baseline_ > 0 ? mean / baseline_ : 0;
+
+  std::array<LatencyHistogram, kNumOperations> latencies;
+  LatencyHistogram all;
+  for (const auto &result : results) {
+    for (size_t op = 0; op < kNumOperations; op++) {
+      latencies[op].Merge(result.latencies[op]);
+      all.Merge(result.latencies[op]);
+    }
+  }
+
+  std::cout << std::fixed;
+  if (format_ == Format::kCsv) {
+    std::cout << name << "," << num_threads << "," << results.size() << ","
+              << std::setprecision(0) << mean << "," << stddev << ",";
+    if (speedup > 0) {
+      std::cout << std::setprecision(3) << speedup;
+    }
+    std::cout << "," << all.Percentile(0.5) << "," << all.Percentile(0.99)
+              << "," << all.Percentile(0.999) << std::endl;
+  } else if (format_ == Format::kJson) {
+    std::cout << (num_points_ == 0 ? "\n" : ",\n") << "  {\"set\": \""
+              << name << "\", \"threads\": " << num_threads
+              << ", \"repetitions\": " << results.size()
+              << ", \"mean_ops_per_s\": " << std::setprecision(0) << mean
+              << ", \"stddev_ops_per_s\": " << stddev << ", \"speedup\": ";
+    if (speedup > 0) {
+      std::cout << std::setprecision(3) << speedup;
+    } else {
+      std::cout << "null";
+    }
+    std::cout << ", \"p50_ns\": " << all.Percentile(0.5)
+              << ", \"p99_ns\": " << all.Percentile(0.99)
+              << ", \"p999_ns\": " << all.Percentile(0.999) << "}"
+              << std::flush;
+  } else {
+    std::cout << name << " (" << num_threads << " threads): "
+              << std::setprecision(0) << mean << " ops/s";
+    if (results.size() > 1) {
+      std::cout << ", stddev " << stddev;
+    }
+    if (speedup > 0) {
+      std::cout << ", speedup " << std::setprecision(2) << speedup;
+    }
+    std::cout << std::endl;
+    for (size_t op = 0; op < kNumOperations; op++) {
+      const LatencyHistogram &histogram = latencies[op];
+      if (histogram.Count() == 0) {
+        continue;
+      }
+      std::cout << "  " << std::left << std::setw(9) << kOperationNames[op]
+                << std::right << std::setw(12) << histogram.Count()
+                << " calls  p50 " << histogram.Percentile(0.5)
+                << " ns  p99 " << histogram.Percentile(0.99) << " ns  p999 "
+                << histogram.Percentile(0.999) << " ns" << std::endl;
+    }
+    if constexpr (stats::kEnabled) {
+      stats::Snapshot snapshot;
+      for (const auto &result : results) {
+        snapshot.Merge(result.stats);
+      }
+      stats::Print(std::cout, snapshot);
+    }
+  }
+  num_points_++;
+}
+
+void Report::Finish() {
+  if (format_ == Format::kJson) {
+    std::cout << "\n]" << std::endl;
+  }
+}
+
+} // namespace workload
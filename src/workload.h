@@ -0,0 +1,257 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/hash_set_base.h"
+#include "src/stats.h"
+
+// Benchmark driver running a configurable mix of Contains, Add and Remove
+// calls against a hash set for a fixed amount of time, with keys drawn from a
+// chosen distribution. Reports throughput and per-operation latency
+// percentiles, optionally for a sweep of thread counts with every point
+// repeated, as text, CSV or JSON.
+namespace workload {
+
+enum class Distribution { kUniform, kZipfian, kSequential, kHotspot };
+
+// How threads are pinned to CPUs: not at all, filling one socket before the
+// next, or spreading consecutive threads across sockets
+enum class PinPolicy { kNone, kCompact, kScatter };
+
+enum class Format { kText, kCsv, kJson };
+
+// How the threads call the set: through its concrete type, through
+// HashSetBase, or each in turn
+enum class Dispatch { kStatic, kVirtual, kBoth };
+
+enum Operation : size_t { kContains, kAdd, kRemove, kNumOperations };
+
+struct Options {
+  size_t num_threads = 1;
+  // Runs every set at 1, 2, 4, ... threads up to the hardware concurrency
+  // instead of at |num_threads|
+  bool sweep = false;
+  // Runs of every set and thread count, averaged in the report
+  size_t repetitions = 1;
+  PinPolicy pin = PinPolicy::kNone;
+  Format format = Format::kText;
+  size_t initial_capacity = 16;
+  // Percentage of calls to Contains, Add and Remove, summing to 100
+  std::array<size_t, kNumOperations> mix = {95, 4, 1};
+  Distribution distribution = Distribution::kZipfian;
+  // Keys are drawn from [0, key_range)
+  size_t key_range = size_t{1} << 20;
+  // Fraction of the key range added before the clock starts
+  double prefill = 0.5;
+  size_t duration_ms = 2000;
+  Dispatch dispatch = Dispatch::kStatic;
+  // Names of the sets to run, or every set if empty
+  std::vector<std::string> sets;
+};
+
+// Fills |options| from flags of the form --name=value. Prints the usage and
+// returns false if a flag is unknown or malformed
+bool ParseOptions(int argc, char **argv, Options *options);
+
+// Draws keys for one thread. Zipfian keys follow Gray et al.'s generator with
+// the exponent used by YCSB, so that key 0 is the most popular. Hotspot keys
+// fall in the first tenth of the range for nine operations in ten
+class KeyGenerator {
+public:
+  explicit KeyGenerator(const Options &options);
+
+  // Returns a copy seeded for thread |id|, whose sequential keys start at its
+  // own slice of the range
+  [[nodiscard]] KeyGenerator ForThread(size_t id) const;
+
+  int Next();
+
+  // Returns a number in [0, 100) picking the operation to run
+  size_t NextPercent() { return engine_() % 100; }
+
+private:
+  static constexpr double kZipfianTheta = 0.99;
+  static constexpr double kHotKeyFraction = 0.1;
+  static constexpr double kHotOperationFraction = 0.9;
+
+  Distribution distribution_;
+  size_t key_range_;
+  size_t num_threads_;
+  std::mt19937_64 engine_;
+  std::uniform_real_distribution<double> unit_{0.0, 1.0};
+  size_t next_sequential_ = 0;
+  // Constants of the Zipfian generator, which only depend on the key range
+  double zeta_n_ = 0;
+  double alpha_ = 0;
+  double eta_ = 0;
+
+  size_t NextZipfian();
+};
+
+// Latencies in nanoseconds bucketed on a log-linear scale: sixteen buckets
+// per power of two, so percentiles are off by at most 1/16
+class LatencyHistogram {
+public:
+  void Record(uint64_t nanos) { counts_[BucketOf(nanos)]++; }
+
+  void Merge(const LatencyHistogram &other);
+
+  [[nodiscard]] uint64_t Count() const;
+
+  // Returns the lower bound of the bucket holding the |quantile| latency
+  [[nodiscard]] uint64_t Percentile(double quantile) const;
+
+private:
+  static constexpr size_t kSubBucketBits = 4;
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+
+  std::array<uint64_t, 64 * kSubBuckets> counts_{};
+
+  static size_t BucketOf(uint64_t nanos);
+  static uint64_t LowerBound(size_t bucket);
+};
+
+struct Result {
+  double seconds = 0;
+  std::array<LatencyHistogram, kNumOperations> latencies;
+  // Empty unless built with HASH_SET_STATS
+  stats::Snapshot stats;
+};
+
+// Returns the thread counts every set is run at
+std::vector<size_t> ThreadCounts(const Options &options);
+
+// Returns the CPUs this process may run on, in the order threads are pinned to
+// them under |policy|. Empty if threads are not pinned
+std::vector<size_t> CpuOrder(PinPolicy policy);
+
+// Restricts |thread| to |cpu|, where the platform supports it
+void PinThread(std::thread &thread, size_t cpu);
+
+// Runs the operation mix on |hash_set| until |stop| is set, once |start| is.
+// Instantiated with the concrete set type, the calls are direct; with
+// HashSetBase<int>, they go through the virtual table
+template <typename HashSetType>
+void ThreadBody(HashSetType &hash_set, const Options &options,
+                KeyGenerator generator, const std::atomic<bool> &start,
+                const std::atomic<bool> &stop,
+                std::array<LatencyHistogram, kNumOperations> &latencies) {
+  size_t add_threshold = options.mix[kContains];
+  size_t remove_threshold = add_threshold + options.mix[kAdd];
+  while (!start.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+  while (!stop.load(std::memory_order_relaxed)) {
+    size_t percent = generator.NextPercent();
+    int key = generator.Next();
+    auto begin_time = std::chrono::steady_clock::now();
+    Operation op;
+    if (percent < add_threshold) {
+      op = kContains;
+      (void)hash_set.Contains(key);
+    } else if (percent < remove_threshold) {
+      op = kAdd;
+      hash_set.Add(key);
+    } else {
+      op = kRemove;
+      hash_set.Remove(key);
+    }
+    auto end_time = std::chrono::steady_clock::now();
+    latencies[op].Record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end_time -
+                                                             begin_time)
+            .count()));
+  }
+}
+
+// Adds the prefill fraction of the key range, picked pseudo-randomly
+void Prefill(HashSetBase<int> &hash_set, const Options &options);
+
+// Prints the results of every set and thread count to stdout as soon as they
+// are measured. Speedups are relative to the single-threaded throughput of the
+// set named "sequential", so they are only reported if it runs first
+class Report {
+public:
+  explicit Report(const Options &options);
+
+  // Reports the repeated runs of |name| at |num_threads| threads
+  void Add(const std::string &name, size_t num_threads,
+           const std::vector<Result> &results);
+
+  // Closes the output once every set has been added
+  void Finish();
+
+private:
+  Format format_;
+  // Throughput of the sequential set, or 0 if it has not been run
+  double baseline_ = 0;
+  size_t num_points_ = 0;
+};
+
+// Runs the workload on a fresh |HashSetType|, calling it through HashSetBase if
+// |options| ask for virtual dispatch
+template <typename HashSetType> Result RunWorkload(const Options &options) {
+  static_assert(IsHashSet<HashSetType, int>::value,
+                "RunWorkload needs a hash set of ints");
+  HashSetType hash_set(options.initial_capacity);
+  Prefill(hash_set, options);
+
+  KeyGenerator generator(options);
+  std::vector<size_t> cpus = CpuOrder(options.pin);
+  std::vector<std::array<LatencyHistogram, kNumOperations>> latencies(
+      options.num_threads);
+  std::atomic<bool> start(false);
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> threads;
+  threads.reserve(options.num_threads);
+  for (size_t i = 0; i < options.num_threads; i++) {
+    if (options.dispatch == Dispatch::kVirtual) {
+      threads.emplace_back(ThreadBody<HashSetBase<int>>,
+                           std::ref<HashSetBase<int>>(hash_set),
+                           std::cref(options), generator.ForThread(i),
+                           std::cref(start), std::cref(stop),
+                           std::ref(latencies[i]));
+    } else {
+      threads.emplace_back(ThreadBody<HashSetType>, std::ref(hash_set),
+                           std::cref(options), generator.ForThread(i),
+                           std::cref(start), std::cref(stop),
+                           std::ref(latencies[i]));
+    }
+    if (!cpus.empty()) {
+      PinThread(threads.back(), cpus[i % cpus.size()]);
+    }
+  }
+
+  auto begin_time = std::chrono::steady_clock::now();
+  start = true;
+  std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+  stop = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto end_time = std::chrono::steady_clock::now();
+
+  Result result;
+  result.stats = hash_set.Stats();
+  result.seconds = std::chrono::duration<double>(end_time - begin_time).count();
+  for (const auto &thread_latencies : latencies) {
+    for (size_t op = 0; op < kNumOperations; op++) {
+      result.latencies[op].Merge(thread_latencies[op]);
+    }
+  }
+  return result;
+}
+
+} // namespace workload
+
+#endif // WORKLOAD_H